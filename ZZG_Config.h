@@ -21,4 +21,36 @@
 #endif
 //*************END****************
 
+//**********数据预取*************
+//zPrefetch(p):把p指向的数据预先读入CPU缓存，不等待读取完成。只是提示，不会出错
+#if defined(ZZG_MSVC)
+#include <xmmintrin.h>
+#define zPrefetch(p)	_mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define zPrefetch(p)	__builtin_prefetch(p)
+#endif
+//*************END****************
+
+//**********大文件*************
+//zFseek64(f,Offset):把文件f的读写位置设置到离文件头Offset字节处，Offset可以超过2GB。成功返回0
+#include <cstdio>
+#if defined(ZZG_MSVC)
+#define zFseek64(f, Offset)	_fseeki64(f, (__int64)(Offset), SEEK_SET)
+#else
+#define zFseek64(f, Offset)	fseeko(f, (off_t)(Offset), SEEK_SET)
+#endif
+//*************END****************
+
+//**********缓存行*************
+//ZZG_CACHE_LINE:CPU缓存行的字节数。多个线程频繁修改的数据按它对齐，避免伪共享
+#define ZZG_CACHE_LINE	64
+//*************END****************
+
+//**********SIMD指令集*************
+//SSE2。x86-64处理器都支持SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ZZG_SSE2
+#endif
+//*************END****************
+
 #endif
@@ -15,7 +15,22 @@ MyHash.Value(1001,&Value);
 * Check source code comments for more specifications. The access efficiency of a hash table depends largely on the hash function.
 * If you are not satisfied with the default hash function, you may use the member function SetHashFunction() to set  your own hash
 * function. So far I've only defined default hash functions for the basic types (integers, floating numbers, and pointers),
-* std::string,std::wstring and QString. Please define for other types yourself
+* std::string,std::wstring and QString. Please define for other types yourself. A hash function takes only the key and returns a full-width hash
+* which doesn't depend on the size of the hash table(see zHashFun)
+* A std::string(std::wstring) key can be looked up by std::string_view(std::wstring_view) or a C string without constructing a string,
+* e.g. MyStrHash.Value("abc",&Value). Emplace() constructs the key and the value in place in the hash table
+* To use zHash as a bounded cache in front of a slower store,call SetCacheSize(MaxItems) or SetCacheBytes(Bytes) first. Insertions then
+* evict the least recently looked up items(CLOCK) instead of failing
+* A worker thread may open a session(zHash::SESSION) once,so that its operations register in a cache line of its own
+* BulkLoad(First,Last,Threads) fills an empty hash table from a range of pairs in parallel,without any lock
+* Visit(Key,Fun) reads a large value in place without copying it. Replace()+VisitRcu() treat the values as immutable(RCU):
+* a writer replaces the whole data node,and the readers read without any lock
+* LockItem()/UnlockItem() hold one item across a multi-step update without holding its bucket
+* InsertWithTTL()/UpsertWithTTL() insert items which expire after a time. Expired items are absent at once,and their memory is reclaimed
+* lazily,or by ReapExpired() which may be called regularly by a thread of your own or by the thread started with StartReaper()
+* Define ZZG_INLINE_HEAD before including this file to keep a copy of the first item of each bucket in the bucket table,if the keys and
+* the values are small trivial types. A lookup which finds it reads one cache line,but the bucket table takes twice the memory,and Update()
+* and Compute() write lock the bucket
 
 ********Technical specification *****************
 
@@ -27,7 +42,10 @@ The data nodes attached to each bucket are organized in two ways: a linked list
 data nodes in each bucket is exclusive.That is, only one thread can operate in inserting or removing.Other threads must wait, cannot read data,
 cannot modify data. It's necessary to get the read lock of  the bucket entry for read and modify operations.
 
-3, Read is completely concurrent, a data node can be read by multiple threads at the same time. During reading, the bucket is read locked and cannot be inserted or deleted data.
+3, Read is completely concurrent, a data node can be read by multiple threads at the same time. Reading a bucket with a linked list takes no lock at all.
+Each bucket entry has a version which is changed by every write locking,so the reader validates what it has seen in the bucket by the version.
+A deleted data node is retired instead of being freed at once,and it's freed after all readers which might see it have left(see zEpoch).
+Reading a bucket with a B-tree takes the read lock of the bucket,because the B-tree can't be traversed while it's being changed.
 
 4, the updating of the data node is exclusive, only one thread at the same time can update after obtaining the write lock of the version lock.
 The bucket is read locked and cannot be insert and delete data.
@@ -35,6 +53,30 @@ The bucket is read locked and cannot be insert and delete data.
 5, the reading and updating of the data node can be carried out concurrently, and the reading thread determines whether the data is consistent by version comparison.
 In general, the read and update operations are fully concurrent; Insert and delete are concurrent at the bucket level
 
+6, Resizing is incremental. When the number of items reaches the threshold, a new bucket table with double buckets is allocated and coexists
+with the old one. Each operation moves a few buckets(MOVE_STEP) of the old table into the new table, and an insertion always moves the old
+bucket of its key first. After the last bucket is moved, the hash table pauses only to wait for the operations in progress, then frees the old table.
+Resizing workers(see SetResizeThreads()) may move the buckets in parallel with the visitors. Each thread claims a chunk of
+consecutive old buckets at a time,and the old bucket i only goes to the new buckets i and i+Buckets,so the threads never write the same region.
+Moving a bucket only relinks its data nodes into the new table. The data nodes are allocated from a pool which grows with the table(zMemPool),
+so they never move,and their keys and values are never copied or hashed again.
+When most items have been deleted(the number of items falls below a quarter of the threshold,see TABLE::LowWater),the table is shrunk
+the same way into a table with half buckets,but never below the initial number of buckets. Since the load after shrinking is still
+half of the threshold,the table grows or shrinks again only after the number of items doubles or halves,so it never thrashes.
+When shrinking,the last segment of the data node pool is closed if the rest of the pool is enough for the smaller table. The data nodes in it are
+copied into the other segments while their buckets are being moved,and the segment is returned to the heap when the old table is freed.
+A value which can only be moved is moved instead,but only if VisitRcu() has never been called,because it reads the values in place without lock.
+Otherwise such data nodes stay where they are,and a segment which still holds any of them is kept.
+The visitor counter and the item counter are striped over per-thread slots(STAT_SLOT),so begin()/end() and counting an item don't write
+a cache line shared by all threads. The items are added to the shared count in batches,and resizing is triggered by that approximate count.
+
+7, zShardedHash splits the items into several independent zHash shards by the high bits of the hash,while each shard selects the bucket by the low bits.
+Each shard has its own visitor counters,resizing state and pools,so the threads visiting different shards don't share those cache lines,and
+a shard which is resizing never pauses the others. See the comments before zShardedHash.
+
+8, zFlatHash is a sibling of zHash for small trivially copyable keys and values. It stores the items in a flat slot array and probes 16 slots at once
+with SSE2 instructions. See the comments before zFlatHash.
+
 /*****************consideration for improvement*************
 * If there are too many hash collisions, the concurrency performance will be reduced due to the presence of bucket locks. There are two optimization ways:
 
@@ -48,90 +90,142 @@ In general, the read and update operations are fully concurrent; Insert and dele
 #include "ZZG_Mem.h"
 #include "ZZG_Sync.h"
 #include <string>
+#include <string_view>
+#include <utility>
+#include <thread>
+#include <vector>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
 #include <new>
+#if defined(ZZG_SSE2)
+#include <emmintrin.h>
+#endif
 using namespace std;
 #define MAX_LINKEDLIST_SIZE	6	//The maximum length of a linked list attached to a hash table entry, beyond which a B-tree is used instead
 #define MIN_BTREE_SIZE	5	//The minimum size of B-tree attached to the hash table entry, less than this size the linked list is used instead
+#define BTREE_POOL_DIV	64	//The B-tree node pool of a table starts with a node per BTREE_POOL_DIV items of the threshold,and doubles when it's full
+#define MOVE_STEP	2	//The number of buckets of the old table moved by each operation while resizing
+#define MOVE_CHUNK	64	//The number of buckets of the old table claimed at a time by the resizing workers and grow()
+#define PARALLEL_MOVE_MIN	16384	//The resizing workers are started only if the old table has at least this number of buckets
+#define SCAN_CHUNK	64	//The number of buckets scanned by ForEach() between begin() and end()
+#define MIN_BUCKETS	256	//The default initial number of buckets. The table isn't shrunk below the initial number of buckets
+#define RETIRE_BATCH	64	//The number of deleted data nodes retired before they are freed together
+#define OPTIMISTIC_TRIES	3	//The number of tries to read a bucket without locking before reading it with the read lock
+#define BATCH_STEP	16	//The number of keys prefetched together by the batch functions
+#define STAT_SLOTS	64	//The number of the per-thread counter slots.It must be an integer power of 2
+#define COUNT_BATCH	64	//The maximum number of items a thread counts in its slot before adding them to DataCount
+#define MAX_SESSIONS	256	//The maximum number of sessions open at a time on a hash table. See zHash::SESSION
+#define STAT_TREE_HIST	16	//The number of the groups of the B-tree size histogram
+#define SNAPSHOT_BLOCK	4096	//The number of items read or written at a time by the snapshot functions
+#define SNAPSHOT_VERSION	1	//The version of the snapshot file format
+#define BULK_MIN	65536	//The minimum number of items for each thread of BulkLoad()
+#define EVICT_SCAN	64	//The maximum number of buckets checked by the eviction hand for an insertion in cache mode
+#define TTL_TICK	100	//The time span of a slot of the expiration wheel in milliseconds
+#define TTL_SLOTS	256	//The number of slots of the expiration wheel.It must be an integer power of 2
+//The bucket table is aligned to a cache line.By default two bucket entries share a cache line,and an entry never straddles two.
+//If ZZG_PAD_BUCKETS is defined before including this file,each entry has a cache line of its own,so that the writers of a bucket
+//don't disturb the threads using its neighbours. It doubles the memory of the bucket table.
+//If ZZG_INLINE_HEAD is defined,each entry has a cache line of its own too,and for small trivial keys and values(e.g. integers) the rest of
+//the line holds a copy of the first item of the linked list,so that a lookup which hits it reads one cache line only(see zHash::INLINE_HEAD)
+#if defined(ZZG_PAD_BUCKETS) || defined(ZZG_INLINE_HEAD)
+#define BUCKET_ALIGN	ZZG_CACHE_LINE
+#else
+#define BUCKET_ALIGN	(ZZG_CACHE_LINE / 2)
+#endif
 
 namespace ZZG {
 
 // Hash function definition. The quality of hash function greatly affects the performance of hash table.
+// A hash function returns a full-width hash which doesn't depend on the size of the bucket table. The hash is computed once and stored in
+//the data node,and the bucket position is always taken from its lower bits,so resizing never calls the hash function again.
+//So the hash function must pass the effect of the change in any bit of the key to the low bits.
+
+//Mixes all bits of (h) into its lower bits. The multiplication passes the low bits to the high bits,and the shift brings them back
+inline size_t zHashMix(uint64_t h)
+{
+    h *= 0x9E3779B97F4A7C15ull;	//2^64 divided by the golden ratio
+    return (size_t)(h ^ (h >> 32));
+}
+
 // Hash of numeric numbers, including integers, floating-point numbers, and Pointers.The type size shouldn't be longer than that of size_t
-// Be careful not to directly take number as hash unless they are consecutive integers. Considering that we only take the lower part of the hash
-//value as the address of the hash bucket entry,the hash function only needs to pass the effect of the change in the high bits to the low bits,
-//and does not need to consider the effect of the change in the low bits to the high bits. In this way, both the hash distribution and the calculation
-//speed can be balanced.
 template <typename TK,typename=std::enable_if_t<(std::is_arithmetic_v<TK>||std::is_pointer_v<TK>),TK>>
-size_t zHashFun(const TK &Key,uint16_t MaskBits)
+size_t zHashFun(const TK &Key)
 {
     if constexpr(sizeof(TK)==8)
-    {
-        uint64_t Tmp=*(uint64_t*)&Key;
-		uint64_t h = Tmp;
-		while (Tmp >>= MaskBits)
-			h^= Tmp;
-		return h;
-    }
+        return zHashMix(*(uint64_t*)&Key);
     else if constexpr(sizeof(TK)==4)
-    {
-        uint32_t Tmp=*(uint32_t*)&Key;
-		uint32_t h = Tmp;
-		while (Tmp >>= MaskBits)
-			h ^= Tmp;
-		return h;
-    }
+        return zHashMix(*(uint32_t*)&Key);
     else if constexpr(sizeof(TK)==2)
-    {
-        uint16_t Tmp=*(uint16_t*)&Key;
-		uint16_t h = Tmp;
-		while (Tmp >>= MaskBits)
-			h ^= Tmp;
-		return h;
-    }
+        return zHashMix(*(uint16_t*)&Key);
     else
-    {
-        uint8_t Tmp=*(uint8_t*)&Key;
-        return Tmp;
-    }
+        return zHashMix(*(uint8_t*)&Key);
 }
 
-//hash function for C++ standard string
-size_t zHashFun(const std::string &Key,uint16_t MaskBits)
+//hash function for C++ standard string view.The string is hashed by its length,so it may contain '\0'
+inline size_t zHashFun(std::string_view Key)
 {
-	int8_t* pc = (int8_t*)Key.data();
+	const int8_t* pc = (const int8_t*)Key.data();
+	const int8_t* pEnd = pc + Key.size();
 	size_t h=0;
-	while (*(pc++))
-        h = *pc + h * 9;//*pc+(h<<3)+h，The number 9 can  be replaced with 3,17,33, etc
-    h ^= (h >> MaskBits);	//Increase the imppact of high bits on low bits, making the hash distribution more even
-	return h;
+	while (pc < pEnd)
+        h = *(pc++) + h * 9;//*pc+(h<<3)+h，The number 9 can  be replaced with 3,17,33, etc
+	return zHashMix(h);	//h*9 only passes the change of the low bits to the high bits
 }
 
-//hash function for C++ wide string
-size_t zHashFun(const std::wstring &Key,uint16_t MaskBits)
+//hash function for C++ standard string.It's the same as the hash of its view,so that a std::string key can be looked up
+//by a std::string_view or a C string without constructing a std::string
+inline size_t zHashFun(const std::string &Key)
+{
+	return zHashFun(std::string_view(Key));
+}
+
+//hash function for C++ wide string view
+inline size_t zHashFun(std::wstring_view Key)
 {
-	wchar_t * pc = (wchar_t*)Key.data();
+	const wchar_t* pc = Key.data();
+	const wchar_t* pEnd = pc + Key.size();
 	size_t h = 0;
-	while (*(pc++))
-		h = *pc + h * 9;//*pc+(h<<3)+h
-    h ^= (h >> MaskBits);	//Increase the imppact of high bits on low bits, making the hash distribution more even
-	return h;
+	while (pc < pEnd)
+		h = *(pc++) + h * 9;//*pc+(h<<3)+h
+	return zHashMix(h);
+}
+
+//hash function for C++ wide string
+inline size_t zHashFun(const std::wstring &Key)
+{
+	return zHashFun(std::wstring_view(Key));
 }
 
 //hash function for Qt string
 #ifdef QSTRING_H
 //test
-size_t zHashFun(const QString &Key,uint16_t MaskBits)
+inline size_t zHashFun(const QString &Key)
 {
     uint16_t * pc =(uint16_t*)Key.constData();
 	size_t h = 0;
 	while (*(pc++))
 	h = *pc+ h * 9;//*pc+(h<<3)+h
-    h ^= (h >> MaskBits);	//Increase the imppact of high bits on low bits, making the hash distribution more even
-	return h;
+	return zHashMix(h);
 }
 #endif
 
 
+//The view type of the key type TK.zHash can look up a key by its view without constructing a TK.
+//e.g. the view of std::string is std::string_view,so a std::string key can be looked up by std::string_view or const char*
+//zNoView means TK has no view type
+struct zNoView {};
+template <class TK>
+struct zKeyView {
+    typedef zNoView type;
+};
+template <class C, class T, class A>
+struct zKeyView<std::basic_string<C, T, A>> {
+    typedef std::basic_string_view<C, T> type;
+};
+
+
 // Data node template
 template <class TK, class TV>
 class DATA_NODE
@@ -143,28 +237,63 @@ public:
     TK key;	//Key
     TV value;	//Value corresponding to the key
     zSeqLock slock;	//Version lock. No lock is required for reading, it has high concurrent efficiency
+    bool Removed;	//true if the data node has been removed from its bucket.It's set with the write lock of slock,and
+                    //the readers without the bucket lock check it with the value
+    volatile bool Referenced;	//The CLOCK bit in cache mode.It's set by the lookups without any lock and cleared by the eviction hand
+    volatile bool Pinned;	//true while the item is locked by zHash::LockItem().It's set with the bucket read locked,so a thread which
+                            //holds the bucket write lock sees it stable,and neither removes nor moves the data node while it's set
+    std::atomic_uint64_t Expire;	//The time(see zHash::nowMs()) when the item expires.0 if it never expires.
+                                    //It's changed with the bucket write locked,and also with the write lock of slock if the item exists
     DATA_NODE *pNext;	//The pointer to the next data node. This member is used  when the datas in the bucket are organized in a linked list
 	DATA_NODE()
-	{};
+	{
+        Removed = false;
+        Referenced = false;
+        Pinned = false;
+        Expire.store(0, std::memory_order_relaxed);
+    };
+    //Constructs the key from (Key) and the value from (args) in place
+    template <class K, class... Args>
+    DATA_NODE(size_t H, K &&Key, Args&&... args) : h(H), key(std::forward<K>(Key)), value(std::forward<Args>(args)...)
+    {
+        Removed = false;
+        Referenced = false;
+        Pinned = false;
+        Expire.store(0, std::memory_order_relaxed);
+    }
 	~DATA_NODE()
 	{};
 };
 
 //Define some constants for B-Tree
-static const int M = 3;                  //The minimum degree of the B-Tree
+//A node holds up to 2*M-1=7 keys,so a B-tree converted from a linked list(MAX_LINKEDLIST_SIZE) takes one node.The 32-bit hashes of
+//the keys(zBTreeNode::H) share the first 32 bytes of the node with KeyNum,so searching a node reads them and one child pointer,
+//one or two cache lines,and dereferences only the data nodes with an equal hash
+static const int M = 4;                  //The minimum degree of the B-Tree
 static const int KEY_MAX = 2 * M - 1;        //All nodes (including root) may contain at most (2*M – 1) keys.
 static const int KEY_MIN = M - 1;          //Every node except the root must contain at least M-1 keys. The root may contain 1 key.
 static const int CHILD_MAX = KEY_MAX + 1;  //Maximum children of a node.The number of a children of a node is equal to the number of keys in it plus 1.
 static const int CHILD_MIN = KEY_MIN + 1;  //Minimum children of a node.
 
+//The nodes are aligned to 32 bytes(see zMemHeap),so that KeyNum and H[] never straddle two cache lines
 template<class TK, class TV>
-class zBTreeNode
+class alignas(32) zBTreeNode
 {
 public:
-    zBTreeNode * parent;	//Pointer to the parent node
+    typedef uint32_t HASH;	//The type of the hashes stored in the node.See fold()
+
     int KeyNum;              //Number of the keys of the node
-    DATA_NODE<TK, TV> *Key[KEY_MAX];     //Keys(Pointers to the data nodes)
+    HASH H[KEY_MAX];	//H[i] is the folded hash of Key[i],so that the keys are compared by hash without dereferencing the data nodes
     zBTreeNode *pChild[CHILD_MAX]; //Pointers to children.If the first is 0, then all must be 0, and the node must be a leaf node
+    DATA_NODE<TK, TV> *Key[KEY_MAX];     //Keys(Pointers to the data nodes)
+    zBTreeNode * parent;	//Pointer to the parent node
+
+    //Folds the hash of a key into the 32 bits stored in H[].The keys are ordered by the folded hash and then by themselves.
+    //The low bits are the same in a bucket and the top bits are the same in a shard of zShardedHash,so the middle bits are taken
+    static HASH fold(size_t h)
+    {
+        return (HASH)(h >> (sizeof(size_t) > 4 ? 22 : 0));
+    }
 
 	zBTreeNode()
 	{}
@@ -173,24 +302,44 @@ public:
 
     // Finds the first element in the Key array that is not less than (key,h) and return the index number
     // If none of the elements are greater than (key,h), then return pNode->KeyNum
-    int searchKey(TK key, size_t h)
+    //(key) may be a TK or its view
+    template <class K>
+    int searchKey(const K &key, HASH h)
 	{
+        //Counts the hashes less than h.The loop has no branch,so the compiler can vectorize it
 		int i = 0;
-		while (i < KeyNum)
-		{
-			if (h < Key[i]->h || (h == Key[i]->h && key < Key[i]->key))
-				return i;
+		for (int j = 0; j < KeyNum; ++j)
+			i += H[j] < h;
+        //Only the keys with the same hash are compared
+		while (i < KeyNum && H[i] == h && !(key < Key[i]->key))
 			++i;
-		}
 		return i;
 	}
 
-    //Inserts (key) at index position (pos)
-	void insertKey(int pos, DATA_NODE<TK, TV> *key)
+    //Makes room for a key with hash (h) at index position (pos)
+    //@ret:the slot for the pointer to the data node
+	DATA_NODE<TK, TV> **openKey(int pos, HASH h)
 	{
 		for (int i = KeyNum - 1; i >= pos; --i)
+		{
 			Key[i + 1] = Key[i];
-		Key[pos] = key;
+			H[i + 1] = H[i];
+		}
+		H[pos] = h;
+		return &Key[pos];
+	}
+
+    //Inserts the key (SrcPos) of node (pSrc) at index position (pos)
+	void insertKey(int pos, const zBTreeNode *pSrc, int SrcPos)
+	{
+		*openKey(pos, pSrc->H[SrcPos]) = pSrc->Key[SrcPos];
+	}
+
+    //Overwrites the key at index position (pos) with the key (SrcPos) of node (pSrc)
+	void copyKey(int pos, const zBTreeNode *pSrc, int SrcPos)
+	{
+		Key[pos] = pSrc->Key[SrcPos];
+		H[pos] = pSrc->H[SrcPos];
 	}
 
 	void insertChild(int pos, zBTreeNode *pN)
@@ -203,7 +352,7 @@ public:
 	void removeKey(int pos)
 	{
 		for (int i = pos + 1; i < KeyNum; ++i)
-			Key[i - 1] = Key[i];
+			copyKey(i - 1, this, i);
 	}
 
 	void removeChild(int pos)
@@ -223,7 +372,19 @@ class zBTree
 private:
     size_t Size;	//Total number of data nodes
     zBTreeNode <TK, TV> * m_pRoot;  //The pointer to the root of the B-tree
-    zMemHeap<zBTreeNode<TK, TV>> * pNodeHeap;	//The memory heap for allocation of zBTreeNode
+    zMemPool<zBTreeNode<TK, TV>> * pNodePool;	//The memory pool for allocation of zBTreeNode
+    typedef typename zBTreeNode<TK, TV>::HASH HASH;
+
+    //Allocates a tree node.The pool is doubled if it's full
+    zBTreeNode<TK, TV> *allocNode()
+    {
+        size_t Capacity = pNodePool->GetCapacity();
+        zBTreeNode<TK, TV> *p = pNodePool->LockAlloc();
+        //Another thread may have grown it meanwhile
+        if (!p && (pNodePool->GetCapacity() != Capacity || pNodePool->Grow(Capacity)))
+            p = pNodePool->LockAlloc();
+        return p;
+    }
 	
 
     // Searches the position of (key,h) in the B-tree. Similar to the search() function, the only
@@ -235,7 +396,8 @@ private:
     //position after (index)
     //@para[memError:out]: If the value is true, the function ends due to memory allocation failure.
     //If the value is false, the function ends normally
-    zBTreeNode <TK, TV> * searchForInsert(const TK &key, size_t h, zBTreeNode <TK, TV> * &hot, int &index, bool &memError);
+    template <class K>
+    zBTreeNode <TK, TV> * searchForInsert(const K &key, HASH h, zBTreeNode <TK, TV> * &hot, int &index, bool &memError);
 
 
     // Splits the node. Returns true on success or false if memory allocation fails
@@ -260,9 +422,9 @@ private:
 
 
 public:
-	zBTree(zMemHeap<zBTreeNode<TK, TV>> * pNodeHeap)
+	zBTree(zMemPool<zBTreeNode<TK, TV>> * pNodePool)
 	{
-		this->pNodeHeap = pNodeHeap;
+		this->pNodePool = pNodePool;
 		m_pRoot = NULL;  //创建一棵空的B树
 		Size = 0;
 	}
@@ -281,23 +443,28 @@ public:
 		return Size;
 	}
 
+    //The following functions accept a TK or its view as (key)
+
     //Insert a new data node for (key,h)
     //@para[h:in]:key's hash
     //@para[pD:out]:points to a data node
     //@ret:returns 0 on success.and (pD) contains the pointer to the pointer to the data node which is empty
     //returns 1 if the key exists in the tree,and (pD) contains the pointer  to the existing data node pointer
-    int Insert(const TK &key, size_t h, DATA_NODE<TK, TV> **&pD);
+    template <class K>
+    int Insert(const K &key, size_t h, DATA_NODE<TK, TV> **&pD);
 
 
     //deletes a node (Key,h)
     //@ret:returns the pointer to the deleted data node.the function is not responsibe for freeing memory
     //returns 0 if (key,h) does not exist in the tree
-    DATA_NODE<TK, TV> * Remove(const TK &key, size_t h);
+    template <class K>
+    DATA_NODE<TK, TV> * Remove(const K &key, size_t h);
 
 
     //gets the pointer to the data node of (key,h)
     //returns the pointer onsuccess,0 otherwise
-    DATA_NODE<TK, TV>* FindData(const TK &key, size_t h)
+    template <class K>
+    DATA_NODE<TK, TV>* FindData(const K &key, size_t h)
 	{
 		int index;
 		zBTreeNode <TK, TV> *pN = Search(key, h, index);
@@ -309,7 +476,8 @@ public:
 
     //Finds the node of (key,h) in the tree
     //Returns the pointer to the node on success,0 otherwise
-    zBTreeNode <TK, TV>* Search(const TK &key, size_t h, int& index);
+    template <class K>
+    zBTreeNode <TK, TV>* Search(const K &key, size_t h, int& index);
 
 
     //Traverses the B-tree, output all data node pointers of the tree to the buffer pointed by pBuf
@@ -322,69 +490,235 @@ public:
 	void Clear();
 };
 
+//The statistics of zHash. See zHash::GetStats()
+struct zHashStats {
+    uint64_t Hits;	//The number of the lookups(Value() and ValueBatch()) which found the key
+    uint64_t Misses;	//The number of the lookups which didn't find the key
+    uint64_t ListToTree;	//The number of the linked lists converted into B-trees
+    uint64_t TreeToList;	//The number of the B-trees converted into linked lists
+    uint64_t Evictions;	//The number of the items evicted in cache mode. See zHash::SetCacheSize()
+    uint64_t Grows;	//The number of the finished resizings which doubled the buckets
+    uint64_t Shrinks;	//The number of the finished resizings which halved the buckets
+    uint64_t ResizeNanos;	//The total duration of the finished resizings in nanoseconds,from starting to freeing the old table
+    uint64_t LastResizeNanos;	//The duration of the last finished resizing in nanoseconds
+    size_t Items;	//The number of items
+    size_t Buckets;	//The number of buckets of the current table
+    bool Resizing;	//true if the old table and the new table coexist
+    size_t DataNodes;	//The number of the data nodes allocated,including the deleted ones waiting to be freed
+    size_t DataNodeCapacity;	//The number of the data nodes which can be allocated from the pool
+    size_t TreeNodes;	//The number of the B-tree nodes allocated
+    size_t TreeNodeCapacity;	//The capacity of the B-tree node pools in nodes
+    size_t SampledBuckets;	//The number of the buckets inspected for the histograms
+    size_t ChainHist[MAX_LINKEDLIST_SIZE];	//ChainHist[i] is the number of the sampled buckets with a linked list of i items
+    size_t TreeHist[STAT_TREE_HIST];	//TreeHist[i] is the number of the sampled buckets with a B-tree of [2^i,2^(i+1)) items
+};
+
+template<class TK, class TV>
+class zShardedHash;
+
 template<class TK, class TV>
 class zHash
 {
+    //zShardedHash hashes a key once to select the shard,then calls the internal functions of the shard with the hash
+    friend class zShardedHash<TK, TV>;
+
     //Do not change the values of these codes, because some functions use numeric values directly
 	enum RETURN_CODE{
         HASH_KEY_EXIST=1,	//the key exists
         ERR_MEMORY	=-1,	//memory error
         SUCCESS	=0	//succeeds
 	};
-    //Defines the type of hash function.
+    //Defines the type of hash function.It returns a full-width hash which doesn't depend on the size of the bucket table
     //@para[Key:in]:Key
-    //@para[MaskBits:in]:equal to the member MaskBits of zHash
-    typedef size_t(*ZHASH_FUNCTION)(const TK &Key,uint16_t MaskBits);
-    zMemHeap<DATA_NODE<TK, TV>> *pHeap;	//The heap for data node memory allocation. At least ThreshHold data nodes can be stored in it
-
-    //memory allocation heap for B-tree node. Centralized storage reduces memory fragmentation and improves access efficiency.
-    //At least KEY_MIN data nodes can be mounted at each tree node. Therefore, as long as (ThreshHold+ KEY_min-1)/KEY_MIN is reserved in advance for
-    //tree nodes allocation,memory shortage of data node will not occur before the number of  data nodes reaches ThreshHold
-	zMemHeap<zBTreeNode<TK, TV>> * pBTNodeHeap;
-
-    // Indicates whether the capacity is being adjusted. If the capacity is being adjusted, the data cannot be accessed and you must
-    // wait for the adjustment to be finished. When the data load reaches the specified amount, the hash table expands automatically.
-	volatile bool FlagResize;
-    bool Resizable;	//Rezizable flag.If true,the capacity will be adjusted according to current data number.If false,the capacity is fixed
-    bool Countable;	//If true,zHash will record the number of items automatically,otherswise it doesn't. Countable must be set true if Resizable is true
-    size_t MaxSize;	//Maximum number of buckets capacity. The maximum number of buckets to be automatically resized cannot exceed this value
+    typedef size_t(*ZHASH_FUNCTION)(const TK &Key);
+
+    //The view type of TK.See zKeyView
+    typedef typename zKeyView<TK>::type KEY_VIEW;
+    //Defines the type of hash function for the key view.It must return the same hash as ZHASH_FUNCTION does for the same key
+    typedef size_t(*ZHASH_VIEW_FUNCTION)(KEY_VIEW Key);
+
+    //true if (K) can be looked up as a KEY_VIEW,e.g. std::string_view or const char* for std::string keys
+    template <class K>
+    static constexpr bool IS_VIEW = !std::is_same_v<KEY_VIEW, zNoView> && !std::is_same_v<std::decay_t<K>, TK>
+                                    && std::is_convertible_v<const K&, KEY_VIEW>;
+
+    //The copy of the first item of a linked list kept in its bucket entry. See INLINE_HEAD
+    struct HEAD_ITEM {
+        TK Key;
+        TV Value;
+        uint64_t Expire;	//See DATA_NODE::Expire
+    };
+    struct NO_HEAD_ITEM {};
+
+    //true if the bucket entries hold a copy of the first item of their linked lists(ENTRY::Copy).It needs ZZG_INLINE_HEAD,and trivial TK and TV
+    //which fit in the cache line with the entry. The copy is refreshed from the first data node whenever the bucket is write unlocked,and the
+    //readers without lock validate it by the version of the bucket as they do the other members. To keep it coherent,the values are changed
+    //only with the bucket write locked(see compute()),instead of with the sequence lock of the data node alone
+#if defined(ZZG_INLINE_HEAD)
+    static constexpr bool INLINE_HEAD = std::is_trivial_v<TK> && std::is_trivial_v<TV> && sizeof(HEAD_ITEM) <= BUCKET_ALIGN / 2;
+#else
+    static constexpr bool INLINE_HEAD = false;
+#endif
 
     //Structure of the bucket entrance
-	struct ENTRY {
+    //The members are ordered to fit in BUCKET_ALIGN bytes
+	struct alignas(BUCKET_ALIGN) ENTRY {
         zBTree<TK, TV> *p;	//the pointer to B-tree of the head of the linked list.0 means no data(empty)
         zRWLock lock;	//read/write lock. You must get the read lock of the bucket before reading/updating data,write lock before inserting/deleting data
-        size_t Size_Type;	//If the datas organized as a B-tree,it's 0. Otherwise a linked list,and the value indicates the number of items
+        uint32_t Size_Type;	//If the datas organized as a B-tree,it's 0. Otherwise a linked list,and the value indicates the number of items
+        uint32_t Head;	//The fingerprint of the hash of the first data node of the linked list.Undefined if the bucket is empty or contains a B-tree.
+                        //Most buckets contain at most one item,so a search which misses is decided by the bucket entry alone
+        volatile bool Moved;	//Only used by the old table while resizing.true means all items of the bucket have been moved into the new table,
+                                //and the bucket will never be used again.It's set with the write lock of the bucket
+        std::conditional_t<INLINE_HEAD, HEAD_ITEM, NO_HEAD_ITEM> Copy;	//The copy of the first item of the linked list if INLINE_HEAD.
+                                                                        //Undefined if the bucket is empty or contains a B-tree
+        std::atomic_uint32_t Version;	//Increases by 1 when the bucket is write locked and again when unlocked. It's odd while the bucket is being changed.
+                                        //The readers without lock compare it before and after reading the bucket
+
+        //Write locks the bucket. All changes of p,Size_Type,Moved and the linked list must be done between WLock() and WUnlock()
+        void WLock()
+        {
+            lock.WLock();
+            //"acquire order" guarantees that the changes are not executed before the version becomes odd
+            std::atomic_fetch_add_explicit(&Version, 1, std::memory_order_acquire);
+        }
+        void WUnlock()
+        {
+            refreshCopy();
+            std::atomic_fetch_add_explicit(&Version, 1, std::memory_order_release);
+            lock.WUnlock();
+        }
+        //Copies the first item of the linked list into Copy if INLINE_HEAD.The bucket must be write locked,or not visible to other threads
+        void refreshCopy()
+        {
+            if constexpr (INLINE_HEAD)
+            {
+                if (p && Size_Type > 0)
+                {
+                    DATA_NODE<TK, TV> *pD = (DATA_NODE<TK, TV>*)p;
+                    Copy.Key = pD->key;
+                    Copy.Value = pD->value;
+                    Copy.Expire = pD->Expire.load(std::memory_order_relaxed);
+                }
+            }
+        }
 	};
 
-    ENTRY *pBucket;	//The pointer to the bucket table
-    size_t Buckets;	//Total number of buckets.It's always an integer power of 2. e.g. 16,32,64,128,256....
+    static_assert(sizeof(ENTRY) == BUCKET_ALIGN, "ENTRY doesn't fit in BUCKET_ALIGN bytes");
+
+    //The fingerprint of hash (h) stored in ENTRY::Head.The hashes in a bucket have the same low bits(the bucket index),and the hashes
+    //in a shard of zShardedHash have the same top bits(up to 10,see MAX_SHARDS).So the 32 bits right below the top 10 are taken,
+    //which are all different from the bucket index bits for a table of up to 2^22 buckets
+    static uint32_t fingerprint(size_t h)
+    {
+        return (uint32_t)(h >> (sizeof(size_t) > 4 ? 22 : 0));
+    }
 
-    size_t PosMask;	//Buckets minus 1. Because Buckets are an integer power of 2, so all bits of PosMask are 1s.
-                    // ANDing any number to PosMask is equivalent to being divided by Buckets. We can get the index
-                    //position of the bucket entry in the bucket table by ANDing hash to PosMask
-    uint16_t MaskBits;//The number of 1s of PosMask(binary)
-    volatile std::atomic_size_t DataCount;	//Current total number of items in zHash
+    //Bucket table.Normally zHash has only one bucket table.While resizing,the old table and the new table coexist.The buckets of the
+    //old table are moved into the new table a few at a time by the threads visiting the hash table,so no thread has to wait for the whole rehashing
+    struct TABLE {
+        ENTRY *pBucket;	//The pointer to the bucket array
+        size_t Buckets;	//Total number of buckets.It's always an integer power of 2. e.g. 16,32,64,128,256....
+        size_t PosMask;	//Buckets minus 1. Because Buckets are an integer power of 2, so all bits of PosMask are 1s.
+                        // ANDing any number to PosMask is equivalent to being divided by Buckets. We can get the index
+                        //position of the bucket entry in the bucket table by ANDing hash to PosMask
+        size_t Threshold;   // Data load threshold. Threshold=Buckets*LoadFactor. When the total number of data reaches this threshold, the hash table starts resizing.
+        size_t LowWater;	//Shrinking threshold. LowWater=Threshold/4. When the total number of data falls below it,the hash table starts shrinking
+        int64_t CountBatch;	//The items counted in a slot are added to DataCount when they reach it. See countItems()
+
+        //memory allocation pool for B-tree node. Centralized storage reduces memory fragmentation and improves access efficiency.
+        //With a good hash function few buckets ever hold a B-tree,so the pool starts small(see BTREE_POOL_DIV) and doubles when it's full,
+        //instead of being reserved for the worst case of all items in the smallest B-trees
+        zMemPool<zBTreeNode<TK, TV>> * pBTNodePool;
+        std::atomic_size_t MovePos;	//Only used by the old table.The next bucket to be moved by the helping threads
+        std::atomic_size_t MovedNum;	//Only used by the old table.The number of buckets which have been moved
+    };
+
+    // Indicates whether the hash table is paused. If so,the data cannot be accessed and you must wait for the pause to be finished.
+    // The hash table pauses only for a short moment at the end of resizing to free the old table,or when CheckHash() runs
+	volatile bool FlagResize;
+    bool Resizable;	//Rezizable flag.If true,the capacity will be adjusted according to current data number.If false,the capacity is fixed
+    bool Countable;	//If true,zHash will record the number of items automatically,otherswise it doesn't. Countable must be set true if Resizable is true
+    size_t MaxSize;	//Maximum number of buckets capacity. The maximum number of buckets to be automatically resized cannot exceed this value
+    size_t MinBuckets;	//The initial number of buckets. The hash table is never shrunk below it
+    size_t CacheSize;	//The maximum number of items in cache mode.0 if the hash table isn't a cache. See SetCacheSize()
+    std::atomic_bool RcuUsed;	//true once VisitRcu() has been called.Only used if TV can't be copied,see moveBucket()
+    std::atomic_size_t ClockHand;	//The next bucket of the current table checked by the eviction hand
+
+    //A slot of the expiration wheel.It holds the hashes of the items which expire in the ticks(TTL_TICK) mapped to it,with their ticks.
+    //The hash finds the bucket in any table,so the wheel doesn't care about resizing.An entry whose item has been deleted or got a new
+    //expiration time is just useless,because the reaper checks the items themselves
+    struct WHEEL_SLOT {
+        zLock lock;
+        std::vector<std::pair<size_t, uint64_t>> Items;
+    };
+    volatile bool HasTTL;	//true after the first item with a TTL is inserted.Until then the expiration is never checked on writing
+    std::atomic<WHEEL_SLOT*> pWheel;	//TTL_SLOTS slots,allocated with the first item with a TTL
+    zLock ReapLock;	//Only one thread runs ReapExpired() at a time
+    std::atomic_uint64_t ReapedTick;	//The last tick reaped by ReapExpired()
+    volatile bool ReaperRun;	//true while the reaper thread started by StartReaper() should go on
+
+    std::atomic<TABLE*> pTab;	//The current bucket table.New items are always inserted into it
+    std::atomic<TABLE*> pTabOld;	//The old bucket table whose buckets are being moved into the current table.0 if the hash table is not resizing
+
+    //The number of items in zHash,except those still counted in the slots(STAT_SLOT::Items). It may be a little below 0 for a while,
+    //as a thread may count the deletion of an item whose insertion is still counted in the slot of another thread. See count()
+    std::atomic_int64_t DataCount;
     double LoadFactor;	//Load factor。The table may be cluttered and have longer search times and collisions if the load factor is  too high.The default value is 0.75
-    size_t Threshold;    // Data load threshold. The load factor is 0.75. Threshold=Buckets*0.75. When the total number of data reaches this threshold, the hash table should be expanded.
-                        // Capacity is expanded only when the data node memory allocation heap pHeap or B-tree node memory allocation heap pBTNodeHeap fails to allocate.
-                        // The actual Threshold is approximately 0 to 1/15 higher than Threshold. If Threshold=0.75, the actual maximum threshold will be 0.80
 
-    zLock ResizeLock;	//Resizing lock.Only one thread is allowed to perform resizing operation at a time
-    volatile std::atomic_uint32_t  Vistors; //Number of threads visiting(all operations including read,update,insert,delete)
+    zLock ResizeLock;	//Resizing lock.Only one thread is allowed to start or finish resizing at a time
+    uint32_t ResizeThreads;	//The number of resizing workers started by each resizing
+    std::atomic_uint32_t WorkerNum;	//The number of resizing workers which haven't exited
+    zEpoch Epoch;	//The readers without lock are registered in it,so that the data nodes they may be reading aren't freed
+
+    //The per-thread counters. Each thread counts in the slot selected by zThreadIndex(),so the threads seldom share a cache line
+    struct alignas(64) STAT_SLOT {
+        std::atomic_uint64_t Hits;
+        std::atomic_uint64_t Misses;
+        std::atomic_uint64_t ListToTree;
+        std::atomic_uint64_t TreeToList;
+        std::atomic_uint64_t Evictions;
+        std::atomic_int64_t Items;	//The items inserted minus the items deleted which haven't been added to DataCount
+        std::atomic_uint32_t Visitors;	//The number of the threads of the slot visiting the hash table. See begin()
+    };
+    STAT_SLOT StatSlots[STAT_SLOTS];
+    //The visitor flag of a session. Only the thread of the session writes Active,so it has a cache line of its own
+    struct alignas(ZZG_CACHE_LINE) SESSION_SLOT {
+        std::atomic_uint32_t Active;	//The number of the visits of the session in progress. See begin()
+        bool Used;	//true while the slot belongs to a session.It's changed with SessionLock locked
+    };
+    std::atomic<SESSION_SLOT*> pSessions;	//MAX_SESSIONS slots,allocated when the first session is opened
+    std::atomic_uint32_t SessionTop;	//The slots [0,SessionTop) have been used by sessions.Only they are checked by waitVisitorsPause()
+    zLock SessionLock;	//Protects the allocation of the session slots
+    //The statistics of resizing. They're changed with ResizeLock locked
+    std::chrono::steady_clock::time_point ResizeStart;	//The time when the resizing in progress started
+    std::atomic_uint64_t Grows;
+    std::atomic_uint64_t Shrinks;
+    std::atomic_uint64_t ResizeNanos;
+    std::atomic_uint64_t LastResizeNanos;
+    std::atomic_size_t SamplePos;	//The bucket from which GetStats() starts sampling next time
+
+    //The pool for data node memory allocation. It's shared by all bucket tables and grows with the current table,so that
+    //at least Threshold data nodes of the current table can be stored in it. The data nodes never move,and resizing only relinks them
+    zMemPool<DATA_NODE<TK, TV>> Pool;
+    zLock RetireLock;	//Protects Retired and RetiredNum
+    size_t RetiredNum;	//The number of data nodes in Retired
+    DATA_NODE<TK, TV> *Retired[RETIRE_BATCH];	//Deleted data nodes waiting for the readers without lock to leave
     ZHASH_FUNCTION pHashFun;	//The pointer to the hash function
+    ZHASH_VIEW_FUNCTION pViewHashFun;	//The pointer to the hash function for the key view.0 if the key view is converted into TK before hashing
 
 public:
-    // Defines the type of a check function.Just for the future
+    // Defines the type of a check function for LockItem()
     //If the return value is 0, the lock condition is met. >0 Does not meet the condition but continues to wait;
     //<0 Does not meet the condition, and you don't want to wait.
     //Extra is used to pass external data to the conditional function
 	typedef int(*CHECK_FP)(TV *, size_t Extra);
 
-    //Data structure used when locking an item of zHash.Just for the future
+    //Data structure used when locking an item of zHash. It's filled by LockItem() and passed to UnlockItem()
 	struct LOCKPACK
 	{
-        TV *pV;	//pointer to the data node
-        void *pE;	//Pointer go the bucket entrance
+        const TV *pV;	//pointer to the value of the locked item
+        DATA_NODE<TK, TV> *pD;	//Pointer to the locked data node
 	};
 
     zHash();
@@ -398,79 +732,415 @@ public:
     //Inserts an item(Key,*pValue)
     //@ret:SUCCESS on success
     //HASH_KEY_EXIST if Key already exists,ERR_MEMORY if no space or resizing(expansion) fails
-    int Insert(TK Key, const TV *pValue);
+    int Insert(const TK &Key, const TV *pValue);
 
     //Inserts an item(Key,Value)
     //@ret:SUCCESS on success
     //HASH_KEY_EXIST if Key already exists,ERR_MEMORY if no space or resizing(expansion) fails
-	int Insert(TK Key, TV Value)
+	int Insert(const TK &Key, const TV &Value)
 	{
 		return Insert(Key,&Value);
 	}
 
+    //Inserts an item(Key,Value).The key and the value are moved into the data node.They are not moved if Key already exists
+    //@ret:the same as Insert(Key,pValue)
+    int Insert(TK &&Key, TV &&Value);
+
+    //Inserts an item whose key is constructed from (Key) and value is constructed from (args) in place in the data node.
+    //(Key) may be a TK,or a view of TK(See zKeyView).The view is used to find the bucket,and the TK is constructed only when inserted
+    //Nothing is constructed if Key already exists
+    //@ret:the same as Insert(Key,pValue)
+    template <class K, class... Args>
+    int Emplace(K &&Key, Args&&... args);
+
     //Inserts/updates an item(Key,*pValue).
     //If Key does not exist,inserting is performed; Otherwise, performs updating
     //@ret:SUCCESS on success
     //ERR_MEMORY if no space or resizing(expansion) fails
-    bool Upsert(TK Key, TV *pValue);
+    bool Upsert(const TK &Key, const TV *pValue);
 
     //Inserts/updates an item(Key,Value).
     //If Key does not exist,inserting is performed; Otherwise, performs updating
     //@ret:SUCCESS on success
     //ERR_MEMORY if no space or resizing(expansion) fails
-	bool Upsert(TK Key, TV Value)
+	bool Upsert(const TK &Key, const TV &Value)
 	{
 		return Upsert(Key, &Value);
 	}
 
+    //Inserts/updates an item(Key,Value).The key and the value are moved into the data node,or the value is moved into the existing one
+    bool Upsert(TK &&Key, TV &&Value);
+
+    //Inserts an item(Key,Value) which expires (TTL) milliseconds later. An expired item is absent for all functions:Value() doesn't find it,
+    //and inserting its key replaces it. Its memory is reclaimed when its bucket is write locked by an insertion or a deletion,or by ReapExpired()
+    //@ret:the same as Insert()
+    int InsertWithTTL(const TK &Key, const TV &Value, uint64_t TTL);
+
+    //Inserts/updates an item(Key,Value) which expires (TTL) milliseconds later. The expiration time of an existing item is replaced.
+    //Upsert() and the other functions keep the expiration time of an existing item,while the items they insert never expire
+    //@ret:the same as Upsert()
+    bool UpsertWithTTL(const TK &Key, const TV &Value, uint64_t TTL);
+
+    //Reclaims the expired items. An item inserted with a TTL is scheduled in the slot of its tick on a wheel of TTL_SLOTS slots of TTL_TICK
+    //milliseconds.This function goes through the slots whose ticks have passed since the last call,and reclaims all expired items of
+    //their buckets,each bucket with one write lock,so there's no scan of the whole table.
+    //Call it every TTL_TICK milliseconds or so from a thread of your own,or let StartReaper() do it.It returns at once if another thread is running it
+    //@ret:the number of the reclaimed items
+    size_t ReapExpired();
+
+    //Starts a background thread which calls ReapExpired() every TTL_TICK milliseconds until the hash table is destroyed
+    //@ret:false if the thread can't be started
+    bool StartReaper();
+
 
     //Gets the value associated with Key.
     //Returns true on success.The value is stored in the buffer Ret pointing to
     //Returns false if zHash contains no item with Key
-	bool Value(TK Key, TV *Ret);
+	bool Value(const TK &Key, TV *Ret);
 
+    //Gets the value associated with the key view (Key).e.g. std::string_view or const char* for std::string keys. No TK is constructed
+    template <class K, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Value(const K &Key, TV *pRet)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        KEY_VIEW View(Key);
+        bool ret = value(View, hashKey(View), pRet);
+        end();
+        countLookups(ret, !ret);
+        return ret;
+    }
 
-    //@para[pRet:in/out]:If pRet set 1 before calling,The deleted data value is store in *pRet after return.Otherwise,the deleted data is discarded
+
+    //@para[pRet:in/out]:If pRet set 1 before calling,The deleted data value is store in *pRet after return.Otherwise,the deleted data is discarded.
+    //If TV can't be copied,the deleted data is always discarded
     //Deletes the item assosiated with Key.
     //@ret:true if the item exists and deleted,false if zHash does not contain the item
-	bool Del(TK Key, TV *pRet = 0);
+	bool Del(const TK &Key, TV *pRet = 0);
+
+    //Deletes the item assosiated with the key view (Key). See Value(K,pRet)
+    template <class K, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Del(const K &Key, TV *pRet = 0)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        KEY_VIEW View(Key);
+        bool ret = del(View, hashKey(View), pRet);
+        end();
+        return ret;
+    }
 
 
     //Updates the item assosiated with Key
     //@para[pValue:in]:Pointer to the new value
     //@ret:true if the item exists and is updated,false if the item doesn't exist
-	bool Update(TK Key, TV *pValue);
+	bool Update(const TK &Key, const TV *pValue);
 
 
     //Updates the item assosiated with Key
     //@para[Value:in]: new value
     //@ret:true if the item exists and is updated,false if the item doesn't exist
-    bool Update(TK Key, TV Value)
+    bool Update(const TK &Key, const TV &Value)
     {
         return Update(Key,&Value);
     }
 
+    //Updates the item assosiated with the key view (Key). See Value(K,pRet)
+    template <class K, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Update(const K &Key, const TV *pValue)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        KEY_VIEW View(Key);
+        bool ret = update(View, hashKey(View), pValue);
+        end();
+        return ret;
+    }
+
+    //Applies Fun(TV &Value) to the value associated with Key in place.The value is write locked by the sequence lock of its data node
+    //while Fun runs,so Fun sees and leaves a consistent value even if other threads update the same item at the same time.
+    //Fun must be short,mustn't throw,and mustn't access the hash table
+    //@ret:true if the item exists and Fun is applied,false if the item doesn't exist
+    template <class F>
+    bool Compute(const TK &Key, F &&Fun)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = compute(Key, hashKey(Key), Fun);
+        end();
+        return ret;
+    }
+    template <class K, class F, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Compute(const K &Key, F &&Fun)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        KEY_VIEW View(Key);
+        bool ret = compute(View, hashKey(View), Fun);
+        end();
+        return ret;
+    }
+
+    //Applies Fun(TV &Value) to the value associated with Key.If Key doesn't exist,the item (Key,Init) is inserted and Fun is applied to
+    //its value before it becomes visible to other threads.Both are done with one search of the bucket.
+    //Fun is called exactly once,with the bucket write locked.The same restrictions as Compute() apply
+    //@ret:SUCCESS if the item is inserted,HASH_KEY_EXIST if it exists,ERR_MEMORY if no space or resizing(expansion) fails
+    template <class F>
+    int ComputeIfAbsent(const TK &Key, const TV &Init, F &&Fun)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        int ret = insert(Key, hashKey(Key), true, COMPUTE<F>{Init, Fun});
+        end();
+        return ret;
+    }
+
+    //Adds Delta to the value associated with Key.If Key doesn't exist,the item (Key,Delta) is inserted as if its value was 0.
+    //TV must be arithmetic.It's a shortcut of ComputeIfAbsent() for counters,but an existing item is found without locking the bucket
+    //@para[pOld:out]:If it isn't 0,the value before adding is stored in *pOld
+    //@ret:false if no space or resizing(expansion) fails
+    bool FetchAdd(const TK &Key, TV Delta, TV *pOld = 0)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = fetchAdd(Key, hashKey(Key), Delta, pOld);
+        end();
+        return ret;
+    }
+
+    //Calls Fun(const TV &Value) on the value associated with Key in place,so a large value isn't copied out as Value() does.
+    //The bucket is read locked and the writers of the item are locked out(see zSeqLock::LockWriters()) while Fun runs,but the other
+    //readers aren't blocked at all. The same restrictions as Compute() apply
+    //@ret:true if the item exists and Fun is called,false if the item doesn't exist
+    template <class F>
+    bool Visit(const TK &Key, F &&Fun)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = visitValue(Key, hashKey(Key), Fun);
+        end();
+        countLookups(ret, !ret);
+        return ret;
+    }
+    template <class K, class F, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Visit(const K &Key, F &&Fun)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        KEY_VIEW View(Key);
+        bool ret = visitValue(View, hashKey(View), Fun);
+        end();
+        countLookups(ret, !ret);
+        return ret;
+    }
+
+    //Replaces the item associated with Key by a new data node holding (Value),in the way of RCU(read-copy-update).The new data node
+    //takes the place of the old one in the bucket,and the old one is retired,so that it's freed only after the readers without lock
+    //which may be reading it have left. The old value is never changed,and the expiration time is kept
+    //@ret:true if the item exists and is replaced,false if the item doesn't exist or no space
+    bool Replace(const TK &Key, const TV &Value)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = replace(Key, hashKey(Key), Value);
+        end();
+        return ret;
+    }
+    bool Replace(const TK &Key, TV &&Value)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = replace(Key, hashKey(Key), std::move(Value));
+        end();
+        return ret;
+    }
+
+    //Calls Fun(const TV &Value) on the value associated with Key without any lock. Neither the readers nor the writers wait for each other.
+    //It's valid only if the values are changed by Replace(),never in place by Update(),Upsert(),Compute() and so on,
+    //since the value which Fun is reading may be changed by them. Fun must be short,because the retired data nodes can't be freed
+    //while it runs,and mustn't access the hash table.
+    //If TV can't be copied,the values are never moved out of the closed pool segment after it has been called,so shrinking
+    //doesn't return the data node memory any more(see moveBucket()),and it reads with the bucket locked while resizing
+    //@ret:true if the item exists and Fun is called,false if the item doesn't exist
+    template <class F>
+    bool VisitRcu(const TK &Key, F &&Fun)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = visitRcu(Key, hashKey(Key), Fun);
+        end();
+        countLookups(ret, !ret);
+        return ret;
+    }
+
+    //Locks the item associated with Key for a multi-step update,e.g. read,call out,then write.The data node is pinned and the writers
+    //of the item are locked out,but no bucket lock is held after returning,so the other items of the bucket stay fully available,
+    //and the readers of the item still read its value before the update. The other writers of the item,and the threads deleting,
+    //evicting or moving it,wait without holding any lock until UnlockItem() is called. The calling thread mustn't access the item by
+    //any other function before that,or it waits for itself
+    //@para[pCheck:in]:If it isn't 0,it's called with the item locked(see CHECK_FP). The item stays locked only if it returns 0
+    //@para[Pack:out]:the locked item.(Pack.pV) may be read until UnlockItem(),but the new value must be passed to UnlockItem()
+    //@ret:true if the item is locked,false if the item doesn't exist or pCheck returns <0
+    bool LockItem(const TK &Key, LOCKPACK &Pack, CHECK_FP pCheck = 0, size_t Extra = 0)
+    {
+        begin();
+        helpResize(MOVE_STEP);
+        bool ret = lockItem(Key, hashKey(Key), Pack, pCheck, Extra);
+        end();
+        return ret;
+    }
+
+    //Unlocks the item locked by LockItem()
+    //@para[pValue:in]:If it isn't 0,the value of the item is updated to *pValue before unlocking
+    void UnlockItem(LOCKPACK &Pack, const TV *pValue = 0)
+    {
+        DATA_NODE<TK, TV> *pD = Pack.pD;
+        ENTRY *pT = 0;
+        //The copy in the bucket entry(see INLINE_HEAD) changes with the value,so the bucket is write locked.
+        //The data node is pinned,so it's neither removed nor moved
+        if (INLINE_HEAD && pValue)
+        {
+            begin();
+            pT = lockBucket(pD->h);
+        }
+        if (pValue)
+        {
+            pD->slock.WriteBegin();
+            pD->value = *pValue;
+            pD->slock.WriteEnd();
+        }
+        pD->Pinned = false;
+        pD->slock.UnlockWriters();
+        if (pT)
+        {
+            pT->WUnlock();
+            end();
+        }
+        Pack.pD = 0;
+        Pack.pV = 0;
+    }
+
+
+    //Gets the values associated with a batch of keys.
+    //The keys are hashed first,then their bucket entries and data nodes are prefetched in stages,so that the memory accesses overlap.
+    //It's much faster than calling Value() for each key when the hash table is much larger than the CPU cache.
+    //@para[Keys:in]:the keys.@para[Num:in]:the number of keys
+    //@para[pValues:out]:the values are stored in pValues[0...Num-1].The value of a key which doesn't exist is unchanged
+    //@para[pFound:out]:If it isn't 0,pFound[i] is set true if Keys[i] exists,false otherwise
+    //@ret:the number of the keys found
+    size_t ValueBatch(const TK *Keys, size_t Num, TV *pValues, bool *pFound = 0);
+
+
+    //Inserts a batch of items(Keys[i],pValues[i]). See ValueBatch()
+    //@para[pRet:out]:If it isn't 0,pRet[i] is set to the result of inserting Keys[i]. The same as the return value of Insert()
+    //@ret:the number of the items inserted
+    size_t InsertBatch(const TK *Keys, const TV *pValues, size_t Num, int *pRet = 0);
+
+
+    //Deletes the items associated with a batch of keys. See ValueBatch()
+    //@para[pDeleted:out]:If it isn't 0,pDeleted[i] is set true if Keys[i] is deleted,false if it doesn't exist
+    //@ret:the number of the items deleted
+    size_t DelBatch(const TK *Keys, size_t Num, bool *pDeleted = 0);
+
+
+    //Calls Fun(Key,Value) for every item of the hash table. Fun is called without any lock,so it may visit the hash table too.
+    //The buckets are scanned a chunk(SCAN_CHUNK) at a time. The items of a chunk are copied with the bucket read locked and the values
+    //are read with the sequence lock,then Fun is called for them. The hash table is never paused,and resizing goes on between the chunks.
+    //Each item which exists during the whole scan is visited exactly once. An item inserted or deleted during the scan may be visited or not
+    //@para[Fun:in]:a callable object like void Fun(const TK &Key,const TV &Value)
+    //@ret:the number of the items visited
+    template <class F>
+    size_t ForEach(F &&Fun)
+    {
+        return ParallelForEach(1, Fun);
+    }
+
+
+    //The same as ForEach(),but the chunks are scanned by (Threads) threads in parallel,including the calling thread.
+    //Fun is called by the scanning threads at the same time,so it must be thread-safe
+    template <class F>
+    size_t ParallelForEach(uint32_t Threads, F &&Fun);
+
     //Gets current total number of buckets of the hash table
 	size_t GetBucketNum()
 	{
-		return Buckets;
+		return pTab.load(std::memory_order_acquire)->Buckets;
 	}
 
 
+    //Moves at most (Steps) buckets of the old table into the new table if the hash table is resizing.
+    //The threads visiting the hash table move buckets automatically.A helper thread may call this function to finish resizing earlier
+    //@ret:true if the hash table is still resizing after the call,false otherwise
+    bool HelpResize(size_t Steps);
+
+
+    //Sets the number of resizing workers. When resizing starts,the workers are started to move the buckets of the old table
+    //in parallel with the visiting threads,and they exit when all buckets have been claimed. Resizing a large table(with at least
+    //PARALLEL_MOVE_MIN buckets) finishes much earlier on a multi-core machine.
+    //@para[Num:in]:the number of workers. 0 means the buckets are moved only by the visiting threads.The default is 0
+    void SetResizeThreads(uint32_t Num)
+    {
+        ResizeThreads = Num;
+    }
+
+
+    //Returns true if the hash table is resizing,that is,the old bucket table and the new one coexist
+    bool IsResizing()
+    {
+        return pTabOld.load(std::memory_order_acquire) != 0;
+    }
+
+
+    //The session of a worker thread on the hash table. A thread which visits the hash table a lot may open a session once,e.g.
+    //  zHash<int,int>::SESSION Session(MyHash);
+    //While the session is open,the operations of the thread on MyHash register in a cache line of the session's own,written only by
+    //the thread,instead of the counters shared by the threads of the same slot(see begin()). The functions are called as usual.
+    //A session must be created and destroyed by the thread using it,and before the hash table is destroyed. The sessions of a thread nest:
+    //the last one opened is the one in use,and it must be closed first. If MAX_SESSIONS sessions are open,a new one is inactive and changes nothing
+    class SESSION {
+        zHash *pHash;
+        SESSION_SLOT *pSlot;	//0 if the session is inactive
+        SESSION *pPrev;	//The session of the thread opened before this one
+        friend class zHash;
+    public:
+        SESSION(zHash &Hash) : pHash(&Hash), pPrev(pThreadSession)
+        {
+            pSlot = Hash.openSession();
+            pThreadSession = this;
+        }
+        ~SESSION()
+        {
+            pThreadSession = pPrev;
+            if (pSlot)
+                pHash->closeSession(pSlot);
+        }
+        SESSION(const SESSION &) = delete;
+        SESSION &operator=(const SESSION &) = delete;
+
+        //Returns true if the session has a slot of its own
+        bool IsActive()
+        {
+            return pSlot != 0;
+        }
+    };
+
+
     //Sets the initial number of buckets. The number of buckets multiplied by the load factor (0.75 by default) is the amount of data that can be stored
     //@para[InitBuckets:in]: specifies the initial number of buckets to be set. If it is not a power of 2, then the function will round it up to the nearest power of 2
     //@ret: returns true on success. False is returned if memory allocation fails
-    // The default initial bucket number is 256
+    // The default initial bucket number is 256. The hash table is never shrunk below the initial number of buckets
     // This function must be executed before any data operation (insert, delete, modify, read) is performed
     bool SetInitBuckets( size_t InitBuckets);
 
 
     //Sets a new hash function to replace the default
-    //@ret: returns true on success. false is returned if memory allocation fails
+    //@para[pViewFun:in]:the hash function for the key view which returns the same hash as pFun for the same key.
+    //If it's 0,the key view is converted into TK before hashing
     //This function must be executed before any data operation (insert, delete, modify, read) is performed
-    void SetHashFunction(ZHASH_FUNCTION pFun)
+    void SetHashFunction(ZHASH_FUNCTION pFun, ZHASH_VIEW_FUNCTION pViewFun = 0)
     {
         pHashFun=pFun;
+        pViewHashFun=pViewFun;
     }
 
 
@@ -482,7 +1152,7 @@ public:
     bool SetLoadFactor(double LoadFactor)
     {
         this->LoadFactor=LoadFactor;
-        return SetInitBuckets(this->Buckets);
+        return SetInitBuckets(GetBucketNum());
     }
 
 
@@ -506,6 +1176,27 @@ public:
     }
 
 
+    //Turns the hash table into a cache of at most (MaxItems) items. An insertion which exceeds it,or which fails for lack of space
+    //(e.g. SetMaxBuckets() stops growing),evicts items instead. The CLOCK policy approximates LRU: the lookups(Value(),Compute()...) mark
+    //the items they find,and a hand sweeping the buckets gives a marked item a second chance by unmarking it,and deletes an unmarked one.
+    //The inserting thread moves the hand over at most EVICT_SCAN buckets,locking one bucket at a time,so there's no global lock.
+    //The number of evictions is reported by GetStats()
+    //@para[MaxItems:in]:the maximum number of items.0 turns cache mode off.The default is 0
+    //This function must be executed before any data operation (insert, delete, modify, read) is performed
+    void SetCacheSize(size_t MaxItems)
+    {
+        CacheSize = MaxItems;
+        Countable = true;
+    }
+
+    //Turns the hash table into a cache of at most (Bytes) bytes. It's SetCacheSize() with the number of items which fit in (Bytes),counting
+    //a data node and the bucket entries per item at the load factor. The memory that TK or TV allocate by themselves isn't counted
+    void SetCacheBytes(size_t Bytes)
+    {
+        SetCacheSize((size_t)((double)Bytes / (sizeof(DATA_NODE<TK, TV>) + sizeof(ENTRY) / LoadFactor)));
+    }
+
+
     // Sets whether to count items automatically.
     //This function only works on the fixed hash table.No effect on resizable hashtable
     //@para[bCount:in]: If true, records the number of items in the table in real time. Otherwise, doesn't record.
@@ -530,6 +1221,7 @@ public:
     // When the function is executed, the hash table expansion function is suspended, but the data operation is allowed.
     //It's re
     //To get an acurate result,it is recommended to pause the insert and delete operations while running this function
+    //If the hash table is resizing,the buckets which haven't been moved in the old table are counted too
     void CheckHash(size_t &Buckets,size_t &FilledBuckets,size_t &Items,size_t &Collisions, size_t &MaxCollision);
 
 
@@ -547,114 +1239,433 @@ public:
     //@ret: Usually succeeds and returns true. However, if the memory is insufficient, false is returned, indicating that the execution failed
     static bool TestHash(ZHASH_FUNCTION pFun,TK Key[],size_t KeyNum,size_t Buckets,size_t &FilledBuckets,size_t &Collitions,size_t &MaxCollition);
 
+
+    //Gets the statistics without pausing the hash table or waiting for any lock,so it can be called frequently in production.
+    //The counters are summed from the slots of the threads.The histograms are collected from (Samples) buckets spread over the current table,
+    //and each call starts from a different bucket. A B-tree which is being changed is skipped
+    //@para[Stats:out]:the statistics.See zHashStats
+    //@para[Samples:in]:the number of buckets to inspect.0 means no histogram.It's cut to the number of buckets
+    void GetStats(zHashStats &Stats, size_t Samples = 1024);
+
+
+    //Saves all items into the snapshot file (Path). Only for trivially copyable TK and TV.
+    //The file is a header(SNAPSHOT_HEADER) followed by fixed-size records(the 64-bit hash,the bytes of the key and the bytes of the value)
+    //in bucket order.It contains no pointer,so it can be memory mapped and read directly,or loaded by LoadSnapshot().
+    //The items are read by ForEach(),so the hash table can be visited by other threads while saving
+    //@ret:true on success,false if the file can't be written
+    bool SaveSnapshot(const char *Path);
+
+
+    //Inserts all items of the snapshot file (Path) saved by SaveSnapshot(). The existing items with the same keys are overwritten.
+    //The hashes are read from the file instead of being calculated again,so the hash function must be the same as the one used when saving.
+    //If the hash table is empty and resizable,the bucket table is allocated at once for all items,so it's never resized while loading.
+    //In such case no other thread may visit the hash table during the call,as SetInitBuckets() requires
+    //@para[Threads:in]:the number of threads loading different parts of the file in parallel,including the calling thread
+    //@ret:true on success. false if the file can't be read,isn't a snapshot of this type of hash table,or memory allocation fails.
+    //In such case some items may have been inserted
+    bool LoadSnapshot(const char *Path, uint32_t Threads = 1);
+
+
+    //Inserts the items of the range [First,Last) of std::pair<TK,TV>(or any type with the members first and second),with random access iterators.
+    //The existing items with the same keys are overwritten,and of the same keys in the range the last one is kept.
+    //If the hash table is empty,resizable and not a cache,the bucket table is allocated once for all items,and the data nodes in one contiguous block.
+    //The items are hashed and sorted by bucket,then each thread links the items of its own range of buckets with its own part of the block,
+    //so there's no lock at all. In such case no other thread may visit the hash table during the call,as SetInitBuckets() requires.
+    //Otherwise the items are inserted one by one as by Upsert()
+    //@para[Threads:in]:the number of threads,including the calling thread.0 means the number of hardware threads.
+    //Each thread loads BULK_MIN items at least
+    //@ret:true on success,false if memory allocation fails.In such case some items may have been inserted
+    template <class It>
+    bool BulkLoad(It First, It Last, uint32_t Threads = 0)
+    {
+        static_assert(std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>,
+                      "BulkLoad() needs random access iterators");
+        return bulkLoad(First, (size_t)(Last - First), 0, Threads);
+    }
+
 private:
 
+    //Counts (Hits) found and (Misses) not found lookups for the statistics
+    void countLookups(size_t Hits, size_t Misses)
+    {
+        STAT_SLOT &Slot = StatSlots[zThreadIndex() & (STAT_SLOTS - 1)];
+        if (Hits)
+            std::atomic_fetch_add_explicit(&Slot.Hits, Hits, std::memory_order_relaxed);
+        if (Misses)
+            std::atomic_fetch_add_explicit(&Slot.Misses, Misses, std::memory_order_relaxed);
+    }
+
+    //Marks the data node found by a lookup for the eviction hand in cache mode.It's written only if it changes,so that the
+    //cache line of a hot item isn't written by every lookup
+    void touch(DATA_NODE<TK, TV> *pD)
+    {
+        if (CacheSize && !pD->Referenced)
+            pD->Referenced = true;
+    }
+
+    //Write locks the sequence lock of the data node (pD) found with the bucket read locked or without lock.
+    //It fails at once if the item is locked by LockItem(),so that the caller can release what it holds and call waitPinned()
+    static bool lockData(DATA_NODE<TK, TV> *pD)
+    {
+        while (!pD->slock.TryWLock())
+        {
+            if (pD->Pinned)
+                return false;
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    //Waits a moment for an item locked by LockItem(),with no lock held.Visiting is restarted,because the thread holding the item
+    //may wait for the visitors to pause
+    void waitPinned()
+    {
+        end();
+        std::this_thread::yield();
+        begin();
+        helpResize(MOVE_STEP);
+    }
+
+    //Returns the current time in milliseconds for the expiration times.It's monotonic
+    static uint64_t nowMs()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //Returns true if the data node has expired.The clock is read only for a data node with an expiration time
+    static bool expired(DATA_NODE<TK, TV> *pD)
+    {
+        uint64_t Expire = pD->Expire.load(std::memory_order_relaxed);
+        return Expire && Expire <= nowMs();
+    }
+
+    //Unlinks at most (Num) data nodes for which IsVictim(pD) returns true from the bucket (pEntry),which must be write locked,and marks them removed.
+    //The items locked by LockItem() are skipped.
+    //A B-tree keeps at least MIN_BTREE_SIZE-1 items,so that it's converted into a linked list by treeToList() at most once.
+    //The data nodes are stored in Victims[],which must have room for MAX_LINKEDLIST_SIZE.After the bucket is unlocked,they must be passed to freeVictims()
+    //@ret:the number of the unlinked data nodes
+    template <class F>
+    size_t unlinkIf(ENTRY *pEntry, size_t Num, F &&IsVictim, DATA_NODE<TK, TV> **Victims);
+
+    //Retires and uncounts the data nodes unlinked by unlinkIf()
+    void freeVictims(DATA_NODE<TK, TV> **Victims, size_t Count)
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            retireData(Victims[i]);
+            removed();
+        }
+    }
+
+    //Write locks the bucket of the hash (h) and reclaims its expired items.It must be called after begin() and followed by end()
+    //@ret:the number of the reclaimed items
+    size_t reapBucket(size_t h);
+
+    //Puts the hash (h) of an item which expires at (Expire) on the expiration wheel
+    void scheduleExpire(size_t h, uint64_t Expire);
+
+    //See InsertWithTTL() and UpsertWithTTL().It must be called after begin() and followed by end()
+    int insertWithTTL(const TK &Key, size_t h, const TV &Value, uint64_t TTL, bool Overwrite);
+
+    //The loop of the reaper thread started by StartReaper()
+    void reaper();
+
+    //Moves the eviction hand over at most EVICT_SCAN buckets of the current table until (Num) items are evicted.
+    //It must be called after begin() and followed by end(),with no bucket locked
+    //@ret:the number of the evicted items
+    size_t evict(size_t Num);
+
+    //Evicts at most (Num) unmarked items from the bucket (pEntry) and unmarks the others
+    //@ret:the number of the evicted items
+    size_t evictBucket(ENTRY *pEntry, size_t Num);
+
     //Closes the hash table,free all resources
     //Do not visit after closing
     void close();
 
 
     //Waits for all threads to pause
-    //This function is only used when resizing the capacity
+    //This function is only used when finishing resizing or checking the hash table.A visitor which comes after FlagResize is set
+    //leaves its slot again,so each slot is waited for only once
 	void waitVisitorsPause(void)
 	{
+        for (int i = 0; i < STAT_SLOTS; ++i)
+            waitZero(StatSlots[i].Visitors);
+        //A session opened after SessionTop is read sees FlagResize on its first visit
+        SESSION_SLOT *pS = pSessions.load(std::memory_order_acquire);
+        uint32_t Top = SessionTop.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < Top; ++i)
+            waitZero(pS[i].Active);
+	}
+
+    //Waits until the visitor counter (Count) is 0
+    static void waitZero(std::atomic_uint32_t &Count)
+    {
         volatile int count = 3;
-		do {
-			if (!count)
-			{
+        while (Count.load(std::memory_order_acquire))
+        {
+            if (!count)
+            {
                 std::this_thread::yield();
-				count = 3;
-			}
-            else if (!Vistors)//stops waiting if there's no thread running
-                break;
-			--count;
-			for (int i = 0; i < 31; ++i)
+                count = 3;
+            }
+            --count;
+            for (int k = 0; k < 31; ++k)
                 zNop8();
-        } while (true);
-	}
+        }
+    }
 
 
     //Initializes the bucket entrances,excutes constructors for each entrances and assigns necessary initial values
-	void initBucketList()
+	void initBucketList(TABLE *pT)
 	{
-		for (size_t i = 0; i < Buckets; ++i)
+		for (size_t i = 0; i < pT->Buckets; ++i)
 		{
-			new (pBucket + i) ENTRY;
-			pBucket[i].p = 0;
+			new (pT->pBucket + i) ENTRY;
+			pT->pBucket[i].p = 0;
+			pT->pBucket[i].Moved = false;
+            pT->pBucket[i].Version.store(0, std::memory_order_relaxed);
 		}
 	}
 
 
-    //Synchronizes resizing with data operations
-    //All functions which
+    //The session of the calling thread. See SESSION
+    static inline thread_local SESSION *pThreadSession = 0;
+
+    //Gets the slot of the session of the calling thread on this hash table,or 0 if the thread has no active session on it
+    SESSION_SLOT *sessionSlot()
+    {
+        SESSION *pS = pThreadSession;
+        return pS && pS->pHash == this ? pS->pSlot : 0;
+    }
+
+    //Allocates a session slot. See SESSION
+    //@ret:the slot,or 0 if all MAX_SESSIONS slots are used or memory allocation fails
+    SESSION_SLOT *openSession();
+
+    //Returns the slot of a session which is being closed
+    void closeSession(SESSION_SLOT *pSlot)
+    {
+        SessionLock.Lock();
+        pSlot->Used = false;
+        SessionLock.Unlock();
+    }
+
+    //Synchronizes pausing with data operations
+    //All functions which visit the bucket tables must call begin() first,and call end() at last
 	void begin()
     {
 		if (Resizable)
 		{
-            //Increases the number of threads visiting.
+            //Only the thread of a session writes its slot,so the count is changed by a plain store.The seq_cst order pairs with the fence in
+            //finishResize():either this thread sees FlagResize or the pausing thread sees the visit
+            SESSION_SLOT *pSlot = sessionSlot();
+            if (pSlot)
+            {
+                uint32_t Active = pSlot->Active.load(std::memory_order_relaxed);
+                pSlot->Active.store(Active + 1, std::memory_order_seq_cst);
+                if (FlagResize)
+                {
+                    pSlot->Active.store(Active, std::memory_order_release);
+                    zWaitUntil(FlagResize, false);
+                    pSlot->Active.store(Active + 1, std::memory_order_seq_cst);
+                }
+                return;
+            }
+            //Increases the number of threads visiting in the slot of the thread,so that the visitors don't share a counter.
             //"acquire order" guarantees that subsequent(C++ codes order) reads and writes will not be executed until this instruction has been executed
-            std::atomic_fetch_add_explicit(&Vistors,1,std::memory_order_acquire);
-            if(FlagResize)//If being resizing,wait untill it is finished
+            std::atomic_uint32_t &Visitors = StatSlots[zThreadIndex() & (STAT_SLOTS - 1)].Visitors;
+            std::atomic_fetch_add_explicit(&Visitors,1,std::memory_order_acquire);
+            if(FlagResize)//If paused,wait untill it is finished
             {
-                std::atomic_fetch_sub_explicit(&Vistors,1,std::memory_order_acquire);
+                std::atomic_fetch_sub_explicit(&Visitors,1,std::memory_order_acquire);
                 zWaitUntil(FlagResize,false);
                 //"acq_rel order" guarntees strict excecution order
-                std::atomic_fetch_add_explicit(&Vistors,1,std::memory_order_acq_rel);
+                std::atomic_fetch_add_explicit(&Visitors,1,std::memory_order_acq_rel);
             }
 		}
 	}
 
 
-    //This function is only used after a successful inserting operation
-    //Synchronizes resizing with data operations
-	void endAdd()
+    //This function is only used after a successful inserting operation,before end()
+    //Counts the item and starts resizing if the load reaches the threshold
+	void added()
 	{
-		if (Resizable)
-		{
-            std::atomic_fetch_add_explicit(&DataCount,1,std::memory_order_relaxed);
-            //"release order" guarantees all previous(word order) reads/writes are excecuted before the instruction
-            std::atomic_fetch_sub_explicit(&Vistors,1,std::memory_order_release);            
-		}
-		else if (Countable)
-            std::atomic_fetch_add_explicit(&DataCount,1,std::memory_order_relaxed);
+		if (Resizable || Countable)
+            countItems(1);
 	}
 
 
-    //This function is only used after a successful deleting operation
-     //Synchronizes resizing with data operations
-	void endDel()
+    //This function is only used after a successful deleting operation,before end()
+    //Counts the item and starts shrinking if the load falls below the low-water mark
+	void removed()
 	{
-		if (Resizable)
-		{
-            std::atomic_fetch_sub_explicit(&DataCount,1,std::memory_order_relaxed);
-            std::atomic_fetch_sub_explicit(&Vistors,1,std::memory_order_release);            
-		}
-		else if (Countable)
-            std::atomic_fetch_sub_explicit(&DataCount,1,std::memory_order_relaxed);
+		if (Resizable || Countable)
+            countItems(-1);
 	}
 
 
-    //This function is used after reads,updates or failure of add/delete operation.That is to say,after the operation by which the number of items has no change
-	void end()
-	{
-		if (Resizable)
-		{
-            std::atomic_fetch_sub_explicit(&Vistors,1,std::memory_order_release);
-		}
+    //Counts (Delta) items in the slot of the thread. When the slot has counted CountBatch items either way,adds them to DataCount and checks
+    //the load,so DataCount is written once per CountBatch insertions or deletions. It's behind the exact count by at most STAT_SLOTS*CountBatch,
+    //which is an eighth of the threshold at most(see newTable()).A cache counts every item in DataCount,because it evicts by the count
+    void countItems(int64_t Delta)
+    {
+        std::atomic_int64_t &Items = StatSlots[zThreadIndex() & (STAT_SLOTS - 1)].Items;
+        int64_t Count = std::atomic_fetch_add_explicit(&Items, Delta, std::memory_order_relaxed) + Delta;
+        TABLE *pT = pTab.load(std::memory_order_acquire);
+        int64_t Batch = CacheSize ? 1 : pT->CountBatch;
+        if (Count < Batch && Count > -Batch)
+            return;
+        //Another thread of the same slot may have counted meanwhile.Its items are taken as well
+        Count = std::atomic_exchange_explicit(&Items, (int64_t)0, std::memory_order_relaxed);
+        int64_t Total = std::atomic_fetch_add_explicit(&DataCount, Count, std::memory_order_relaxed) + Count;
+        if (!Resizable || pTabOld.load(std::memory_order_relaxed))
+            return;
+        //Starts resizing when the load reaches the threshold or falls below the low-water mark. The buckets are moved later by the visiting threads
+        if (Count > 0 && Total >= (int64_t)pT->Threshold)
+            startResize(pT, true);
+        else if (Count < 0 && Total < (int64_t)pT->LowWater && pT->Buckets > MinBuckets)
+            startResize(pT, false);
+    }
+
+
+    //Gets the number of items counted in DataCount.It's cheap but approximate. See countItems()
+    size_t approxCount()
+    {
+        int64_t Count = DataCount.load(std::memory_order_relaxed);
+        return Count > 0 ? (size_t)Count : 0;
+    }
+
+
+    //Gets the number of items by adding up DataCount and the counts in all slots.It's exact if no thread is inserting or deleting
+    size_t count()
+    {
+        int64_t Count = DataCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < STAT_SLOTS; ++i)
+            Count += StatSlots[i].Items.load(std::memory_order_relaxed);
+        return Count > 0 ? (size_t)Count : 0;
+    }
+
+
+    //This function is used at the end of all operations
+	void end()
+	{
+		if (Resizable)
+		{
+            SESSION_SLOT *pSlot = sessionSlot();
+            if (pSlot)
+                pSlot->Active.store(pSlot->Active.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+            else
+                std::atomic_fetch_sub_explicit(&StatSlots[zThreadIndex() & (STAT_SLOTS - 1)].Visitors,1,std::memory_order_release);
+		}
 	}
 
 
-    // Expansion function. When the number of items reaches Threshold, the hash table will be expanded
-    // The hash table must be locked before executing this function. No thread can access the hash table during expansion
-    // Returned value: true indicates success. false indicates failure, and success is guaranteed unless memory is insufficient
-	bool upSize();
+    //Allocates a bucket table with (Buckets) buckets and the memory heaps for it
+    //@ret:the pointer to the new table,or 0 if memory allocation fails
+    TABLE* newTable(size_t Buckets);
+
+
+    //Frees a bucket table and all resources of it.Destructs the data nodes still attached to the buckets
+    void freeTable(TABLE *pT);
+
+
+    // Starts resizing.Allocates a new table with double(or half) buckets and publishes it as the current table,while (pCur) becomes the old table.
+    // Nothing is moved here.The buckets are moved later by helpResize() and by the threads inserting items.
+    //@para[pCur:in]:the table the caller regards as the current one.Nothing is done if it's not the current table any more
+    //@para[Grow:in]:true to expand the table,false to shrink it
+    //@ret:false if the hash table can't be resized(MaxSize or MinBuckets is reached or no memory),true otherwise
+    //The function never waits,so it can be called by a visiting thread
+	bool startResize(TABLE *pCur, bool Grow);
+
+
+    // Moves at most (Steps) buckets of the old table into the new table if the hash table is resizing.
+    // The thread that moves the last bucket finishes resizing.
+    //Must be called after begin() and without holding any bucket lock
+    void helpResize(size_t Steps);
+
+
+    // Claims chunks of (Chunk) consecutive buckets of the old table and moves them,until all buckets have been claimed or
+    //(MaxChunks) chunks have been moved. The buckets which fail to be moved are left to grow()
+    //Must be called after begin() and without holding any bucket lock
+    //@ret:true if this call has moved the last bucket and finished resizing
+    bool moveChunks(TABLE *pOld, TABLE *pNew, size_t Chunk, size_t MaxChunks);
+
+
+    // The body of a resizing worker.Moves chunks of buckets until all have been claimed,then exits
+    void resizeWorker();
+
+
+    // Moves all items of the bucket (Pos) of the old table (pOld) into the new table (pNew),then marks it as moved
+    // Write locks the old bucket while moving,and write locks each new bucket while linking a data node into it.
+    // The data nodes in the closed segment of the pool are replaced by their copies(see zMemPool::CloseLast())
+    //@ret:SUCCESS if the bucket has been moved(by this thread or another thread),1 if this call has moved the last bucket of the old table,
+    //ERR_MEMORY if memory allocation fails.In such case the bucket is unchanged
+    int moveBucket(TABLE *pOld, TABLE *pNew, size_t Pos);
+
+
+    // Finishes resizing after all buckets of the old table have been moved.
+    // Pauses the hash table just for waiting for the operations in progress to end,because they may still read the old table,then frees the old table.
+    // When shrinking,also frees the retired data nodes at once and returns the closed segment of the pool to the heap
+    //Must be called after begin() and without holding any bucket lock
+    void finishResize(TABLE *pOld);
+
 
+    // Tries to get more space after an insertion failed in the table (pT) for lack of memory.
+    //Must be called after begin() and without holding any bucket lock
+    //@ret:true if the insertion should be tried again,false if no more space can be got
+    bool grow(TABLE *pT);
 
-    // Temporarily suspends all threads visiting and try to expand capacity. Return false on failure, true on success;
-    // This function coordinate threads to suspend for expanding the capacity. Calls the upSize () function to expand the capacity and restores the operation before the expansion
-    // If Resizable is true, then this function is called when allocation of data node fails.
-    // As mentioned above, all threads visiting must be suspended during capacity expansion.
-    bool pauseAndUpsize();
+
+    //The header of the snapshot file. All records follow it. See SaveSnapshot()
+    struct SNAPSHOT_HEADER {
+        char Magic[8];	//"ZZGHASH" with the terminating 0
+        uint32_t Version;	//SNAPSHOT_VERSION
+        uint32_t KeySize;	//sizeof(TK)
+        uint32_t ValueSize;	//sizeof(TV)
+        uint32_t Reserved;	//0
+        uint64_t Count;	//The number of records
+        uint64_t Buckets;	//The number of buckets of the hash table when saving
+    };
+
+    //Replaces the current table with an empty table with (Buckets) buckets. No thread may visit the hash table
+    //@ret:false if memory allocation fails.In such case nothing is changed
+    bool replaceTable(size_t Buckets);
+
+
+    //Inserts the records [Start,End) of the snapshot file (Path). See LoadSnapshot()
+    bool loadRecords(const char *Path, uint64_t Start, uint64_t End);
+
+    //See BulkLoad(). The k-th item is First[pIdx[k]],or First[k] if pIdx is 0
+    template <class It>
+    bool bulkLoad(It First, size_t Num, const size_t *pIdx, uint32_t Threads);
+
+    //Calls Fun(i) for i in [0,Threads) in parallel,Fun(0) by the calling thread.The calls whose threads can't be started are made by the calling thread
+    template <class F>
+    static void runThreads(uint32_t Threads, F &&Fun);
+
+
+    //The items copied by ForEach()
+    typedef std::vector<std::pair<TK, TV>> SCAN_BUF;
+
+    // Claims chunks of the buckets from (Next) and scans them,until all (Units) buckets have been claimed. See ForEach()
+    //@para[Units:in]:the number of buckets of the current table when the scan started. The item with hash h belongs to the bucket h&(Units-1)
+    //@ret:the number of the items visited
+    template <class F>
+    size_t scanChunks(size_t Units, std::atomic_size_t &Next, F &Fun);
+
+
+    // Copies the items of the hash class (h&Mask)==Val in the table (pT). Mask+1 is a power of 2 and Val<=Mask.
+    // If a bucket has been moved,copies its items from the new table (pNew) instead.
+    //Must be called after begin() and without holding any bucket lock
+    //@ret:false if a bucket has been moved and pNew is 0.In such case the table has become the old one and the caller should copy again
+    bool collectItems(TABLE *pT, TABLE *pNew, size_t Mask, size_t Val, SCAN_BUF &Items, std::vector<DATA_NODE<TK, TV>*> &Nodes);
+
+
+    // Copies the items of the bucket (pEntry) whose hashes satisfy (h&Mask)==Val with the bucket read locked.
+    //@para[Nodes:in]:the buffer for the data nodes of a B-tree
+    //@ret:false if the bucket has been moved,true otherwise
+    bool collectBucket(ENTRY *pEntry, size_t Mask, size_t Val, SCAN_BUF &Items, std::vector<DATA_NODE<TK, TV>*> &Nodes);
 
 
     // Round the input number up to an integer power of 2（2 to the power of n,n is an integer
@@ -663,7 +1674,7 @@ private:
 	{
 		size_t tmp = X;
 		size_t ret = 1;
-		
+
 		while (X >>= 1)
 		{
 			ret <<= 1;
@@ -674,41 +1685,227 @@ private:
 
     // Converts the linked list to a B-Tree
     // If memory allocation fails, a failure is returned. Failure does not change the original data
-    bool listToBTree(ENTRY*pT);
+    bool listToBTree(TABLE *pT, ENTRY*pEntry);
 
      // Converts B-Tree to linked list
 	void treeToList(ENTRY*pT);
 
 
-    //Copies item and inserts it into the hash table
-    //Only used when resizing
+    //Links a filled data node into the bucket (pEntry) of the table (pT)
+    //The key of the data node must not exist in the bucket,and the bucket must be write locked
     //@ret:true on success,false on failure
-	bool inserCopyData(DATA_NODE<TK, TV>*pSrc);
+	bool linkData(TABLE *pT, ENTRY *pEntry, DATA_NODE<TK, TV>*pData);
+
+    //Unlinks the data node linked by linkData() from the bucket (pEntry),which must be write locked.It's used by moveBucket() to undo moving
+    void unlinkData(ENTRY *pEntry, DATA_NODE<TK, TV> *pData);
 
 
     //Insert a key value into the specified bucket and  allocates a data node.
     //To use this function, it must be guaranteed that the target bucket is not accessed by other threads
-    //that is, you must call pEntry->lock.WLock() before calling this function,and call pEntry->lock.WUnlock() after it returns.
-    //One more important thing,the value of pEntry may be changed in the function if the hash table resized in it.In such case,the old
-    //pEntry->lock.WUnlock() is called automatically before the pEntry is set a new pointer,and the new pEntry->lock.WLock() is called after in the function
+    //that is, you must call pEntry->WLock() before calling this function,and call pEntry->WUnlock() after it returns.
+    //The function never resizes the hash table.The caller should unlock the bucket and call grow() if ERR_MEMORY is returned
     // Return value: SUCCESS indicates success, HASH_KEY_EXIST indicates that the key exists, and ERR_MEMORY indicates there's no memory
     //(or the amount of the items reaches the maximum).
+    //@para[Key,args:in]:the key and the value of the new data node are constructed from them.The data node is filled before it's linked into the bucket,
+    //because the readers without lock may see it at once. They are not used if the key exists or ERR_MEMORY is returned
     //@para[pRet:out]: returns the allocated data node pointer on success. If the key already exists, returns the existing data node pointer
-    //@para[pEntry:inout]: indicates the pointer to the bucket entry.
-    int  insertKey(ENTRY* &pEntry, size_t h, TK &key, DATA_NODE<TK, TV>* &pRet);
+    //@para[pEntry:in]: indicates the pointer to the bucket entry.
+    template <class K, class... Args>
+    int  insertKey(TABLE *pT, ENTRY* pEntry, size_t h, K &&Key, DATA_NODE<TK, TV>* &pRet, Args&&... args);
+
+
+    //Gets the hash of (Key).It's computed once for each operation,because it doesn't depend on the size of the bucket table
+    size_t hashKey(const TK &Key)
+    {
+        return pHashFun(Key);
+    }
+    size_t hashKey(const KEY_VIEW &Key)
+    {
+        if (pViewHashFun)
+            return pViewHashFun(Key);
+        return pHashFun(TK(Key));
+    }
+
+    //Writes a new value into an existing data node.The caller must hold the write lock of the data node
+    //Replaces the value of an expired item as if it was newly inserted.Unlike assignValue(),the value is always constructed from (args)
+    template <class... Args>
+    static void replaceValue(TV &Value, Args&&... args)
+    {
+        Value = TV(std::forward<Args>(args)...);
+    }
+
+    //The expiration time passed to insert() by the functions without a TTL.A new item never expires,and an existing one keeps its expiration time
+    static constexpr uint64_t EXPIRE_KEEP = ~(uint64_t)0;
+
+    static void assignValue(TV &Value, const TV &New)
+    {
+        Value = New;
+    }
+    static void assignValue(TV &Value, TV &&New)
+    {
+        Value = std::move(New);
+    }
+    template <class... Args>
+    static void assignValue(TV &Value, Args&&... args)
+    {
+        Value = TV(std::forward<Args>(args)...);
+    }
+
+    //The value argument of insert() for ComputeIfAbsent().A new data node is constructed from Init with Fun applied,
+    //while the value of an existing one is passed to Fun by assignValue()
+    template <class F>
+    struct COMPUTE {
+        const TV &Init;
+        F &Fun;
+        operator TV() const
+        {
+            TV Value(Init);
+            Fun(Value);
+            return Value;
+        }
+    };
+    template <class F>
+    static void assignValue(TV &Value, COMPUTE<F> &&C)
+    {
+        C.Fun(Value);
+    }
+
+
+    //The following functions do the work of the public functions with the same names(in upper case).
+    //They must be called after begin() and followed by end(),so that a batch of keys can be processed in one visiting
+    //(Key) is a TK or a KEY_VIEW,and (h) is its hash returned by hashKey()
+
+    //@para[Overwrite:in]:true if the value of an existing key is updated(Upsert),false if it's kept(Insert)
+    //@para[args:in]:the value is constructed from them
+    //@ret:SUCCESS if inserted,HASH_KEY_EXIST if the key exists,ERR_MEMORY if no space or resizing(expansion) fails
+    template <class K, class... Args>
+    int insert(K &&Key, size_t h, bool Overwrite, Args&&... args)
+    {
+        return insertEx(std::forward<K>(Key), h, Overwrite, EXPIRE_KEEP, std::forward<Args>(args)...);
+    }
+    //@para[Expire:in]:the expiration time of the item(see nowMs()),or EXPIRE_KEEP
+    template <class K, class... Args>
+    int insertEx(K &&Key, size_t h, bool Overwrite, uint64_t Expire, Args&&... args);
+    template <class K>
+    bool value(const K &Key, size_t h, TV *pRet);
+    template <class K>
+    bool del(const K &Key, size_t h, TV *pRet);
+    template <class K>
+    bool update(const K &Key, size_t h, const TV *pValue)
+    {
+        return compute(Key, h, [pValue](TV &Value) { Value = *pValue; });
+    }
+    template <class K, class F>
+    bool compute(const K &Key, size_t h, F &&Fun);
+    //See compute().Used if INLINE_HEAD
+    template <class K, class F>
+    bool computeLocked(const K &Key, size_t h, F &&Fun);
+    //See FetchAdd().Existing items are updated by compute() first,so that the bucket is write locked only for inserting
+    template <class K>
+    bool fetchAdd(const K &Key, size_t h, TV Delta, TV *pOld)
+    {
+        static_assert(std::is_arithmetic_v<TV>, "FetchAdd() needs an arithmetic value type");
+        TV Old = TV();
+        auto Add = [&Old, Delta](TV &Value) { Old = Value; Value += Delta; };
+        if (!compute(Key, h, Add))
+        {
+            const TV Zero = TV();
+            if (insert(Key, h, true, COMPUTE<decltype(Add)>{Zero, Add}) == ERR_MEMORY)
+                return false;
+        }
+        if (pOld)
+            *pOld = Old;
+        return true;
+    }
+    //See Visit()
+    template <class K, class F>
+    bool visitValue(const K &Key, size_t h, F &&Fun);
+    //See Replace().The new value is constructed from (args) in the new data node
+    template <class K, class... Args>
+    bool replace(const K &Key, size_t h, Args&&... args);
+    //See VisitRcu()
+    template <class K, class F>
+    bool visitRcu(const K &Key, size_t h, F &&Fun);
+    //See LockItem()
+    template <class K>
+    bool lockItem(const K &Key, size_t h, LOCKPACK &Pack, CHECK_FP pCheck, size_t Extra);
+
+
+    //Finds the bucket for inserting the key with the hash (h) and write locks it.If the hash table is resizing,the bucket of the old table
+    //associated with the key is moved first,so that new items are always inserted into the current table
+    //@para[pEntry:out]:the locked bucket.0 if the old bucket can't be moved,or the current table is full before all buckets have been moved.
+    //In such case no bucket is locked,and the caller should call grow() with the returned table
+    //@ret:the table containing the bucket
+    TABLE* lockForInsert(size_t h, ENTRY *&pEntry);
+
+
+    //Finds the bucket associated with the hash (h) without locking it.If the hash table is resizing and the bucket of the old table hasn't
+    //been moved,returns the old bucket.Otherwise returns the bucket of the current table
+    //The caller must check ENTRY::Moved again after locking the bucket,and try again if it's true
+    TABLE* locate(size_t h, ENTRY *&pEntry);
+
+
+    //Finds the bucket associated with the hash (h) like locate() and write locks it
+    //@ret:the locked bucket.0 if it's empty,and then it isn't locked
+    ENTRY* lockBucket(size_t h);
 
 
     //Searches the data node associated with (key).
-    //Returns the pointer to the data node associated with (key) if the bucket contains the item,or returns 0 if the bucket contains no item with the key
-	DATA_NODE<TK, TV>*searchAndRLock(TK &key, ENTRY *&pEntry);
+    //Returns the pointer to the data node associated with (key) if the bucket contains the item,and the bucket stays read locked.
+    //Returns 0 if the bucket contains no item with the key,and the bucket is not locked
+    template <class K>
+	DATA_NODE<TK, TV>*searchAndRLock(const K &key, size_t h, ENTRY *&pEntry);
+
+
+    //Searches the data node associated with (key) without locking the bucket.Must be called between Epoch.Enter() and Epoch.Leave()
+    //The data node found may be removed at any time,so the caller must check DATA_NODE::Removed after reading the value with the sequence lock
+    //@ret:1 if the data node is found and stored in (pRet),0 if the key doesn't exist.
+    //-1 if the bucket keeps being changed,or it contains a B-tree.In such case the caller should search it again by searchAndRLock()
+    template <class K>
+    int searchOptimistic(const K &key, size_t h, DATA_NODE<TK, TV>* &pRet);
+
+
+    //Searches the copy of the first item in the bucket entry(see INLINE_HEAD) without locking the bucket.No data node is read,
+    //so it can be called out of the epoch
+    //@ret:1 if the first item has (key),and its value is stored in (pRet).0 if the key doesn't exist,or it has expired.
+    //-1 if it can't be decided by the bucket entry alone.In such case the caller should call searchOptimistic()
+    template <class K>
+    int searchCopy(const K &key, size_t h, TV *pRet);
+
+
+    //Retires a data node which has been removed from its bucket.The data node is destructed and freed after all readers
+    //without lock have left.Must be called without holding any bucket lock,because it may wait for the readers
+    void retireData(DATA_NODE<TK, TV> *pData);
+
+
+    //Hashes the keys (Keys[0...Num-1]) into (h),and prefetches their bucket entries and first data nodes.Num must not exceed BATCH_STEP
+    void prefetchBatch(const TK *Keys, size_t Num, size_t *h);
+
+
+    //Frees all retired data nodes after the readers without lock have left.Must be called without holding any bucket lock
+    //@ret:true if any data node is freed
+    bool flushRetired();
+
+
+    //Destructs and frees the data nodes (pBuf[0...Num-1]) which no reader can see any more
+    void freeData(DATA_NODE<TK, TV> **pBuf, size_t Num)
+    {
+        for (size_t i = 0; i < Num; ++i)
+        {
+            pBuf[i]->~DATA_NODE();
+            Pool.LockFree(pBuf[i]);
+        }
+    }
 
 };
 //*************************************************************/
 /*********Function definitions*************/
 /**************************************************************/
 template<class TK, class TV>
-zBTreeNode <TK, TV> *  zBTree<TK, TV>::Search(const TK &key, size_t h, int &index)
+template<class K>
+zBTreeNode <TK, TV> *  zBTree<TK, TV>::Search(const K &key, size_t Hash, int &index)
 {
+    HASH h = zBTreeNode<TK, TV>::fold(Hash);
 	zBTreeNode <TK, TV> * p = m_pRoot;
 	zBTreeNode <TK, TV> * parent = NULL;
 
@@ -723,7 +1920,7 @@ zBTreeNode <TK, TV> *  zBTree<TK, TV>::Search(const TK &key, size_t h, int &inde
 		if (index >= 0)
 		{
             //finds the object
-			if (h == p->Key[index]->h && key == p->Key[index]->key)
+			if (h == p->H[index] && key == p->Key[index]->key)
 				return p;
 		}
         //otherwise,descends to the lower level
@@ -734,7 +1931,8 @@ zBTreeNode <TK, TV> *  zBTree<TK, TV>::Search(const TK &key, size_t h, int &inde
 }
 
 template<class TK, class TV>
-zBTreeNode <TK, TV> *  zBTree<TK, TV>::searchForInsert(const TK &key, size_t h, zBTreeNode <TK, TV> * &hot, int &index, bool &memError)
+template<class K>
+zBTreeNode <TK, TV> *  zBTree<TK, TV>::searchForInsert(const K &key, HASH h, zBTreeNode <TK, TV> * &hot, int &index, bool &memError)
 {
 	zBTreeNode <TK, TV> * p = m_pRoot;
 	hot = NULL;
@@ -748,7 +1946,7 @@ zBTreeNode <TK, TV> *  zBTree<TK, TV>::searchForInsert(const TK &key, size_t h,
 		if (index >= 0)
 		{
 			//已经找到
-			if (h == p->Key[index]->h && key == p->Key[index]->key)
+			if (h == p->H[index] && key == p->Key[index]->key)
 				return p;
 		}
         //or, descends one level
@@ -768,11 +1966,11 @@ zBTreeNode <TK, TV> *  zBTree<TK, TV>::searchForInsert(const TK &key, size_t h,
 
             //Checks the newly added key in the parent node, decides the new searching path according to its value
             //If(key,h) is greater than the newly added key,the node to search for the next step is the node pointed to by the newly added pointer in the parent node
-			if (h > hot->Key[index + 1]->h || (h == hot->Key[index + 1]->h&&key > hot->Key[index + 1]->key))
+			if (h > hot->H[index + 1] || (h == hot->H[index + 1]&&key > hot->Key[index + 1]->key))
 				p = hot->pChild[index + 2];
 			else
                 //ends searching if the newly added key in the parent node is equal to (key,h)
-				if (h == hot->Key[index + 1]->h && key == hot->Key[index + 1]->key)
+				if (h == hot->H[index + 1] && key == hot->Key[index + 1]->key)
 				{
 					++index;
 					return hot;
@@ -782,28 +1980,30 @@ zBTreeNode <TK, TV> *  zBTree<TK, TV>::searchForInsert(const TK &key, size_t h,
 	return NULL;
 }
 template<class TK, class TV>
-int zBTree<TK, TV>::Insert(const TK &key, size_t h, DATA_NODE<TK, TV> **&pD)
+template<class K>
+int zBTree<TK, TV>::Insert(const K &key, size_t Hash, DATA_NODE<TK, TV> **&pD)
 {
+    HASH h = zBTreeNode<TK, TV>::fold(Hash);
     //Checks if the root node is full.Splits it if full
     //The check must be done before search(),otherwise the splitting of the child node of the root will make the number of the children of the root overflow
 	if (m_pRoot&&m_pRoot->KeyNum == KEY_MAX)
 	{
-        zBTreeNode <TK, TV> *pNode = pNodeHeap->LockAlloc();//New root node
+        zBTreeNode <TK, TV> *pNode = allocNode();//New root node
 		if (!pNode)
 			return -1;
         new(pNode) zBTreeNode <TK, TV>;
 
-		zBTreeNode <TK, TV> *pRight = pNodeHeap->LockAlloc();
+		zBTreeNode <TK, TV> *pRight = allocNode();
 		if (!pRight)
 		{
-			pNodeHeap->LockFree(pNode);
+			pNodePool->LockFree(pNode);
 			return -1;
 		}
         new(pRight) zBTreeNode <TK, TV>;  //Creates a new node for splitting,it will become the right sibling node of the original node
 
 		pNode->pChild[0] = m_pRoot;
 		pNode->pChild[1] = pRight;
-        pNode->Key[0] = m_pRoot->Key[KEY_MIN];	//Raises the middle key to the new root node as the first key
+        pNode->copyKey(0, m_pRoot, KEY_MIN);	//Raises the middle key to the new root node as the first key
 		pNode->KeyNum = 1;
 		pNode->parent = 0;
 
@@ -811,7 +2011,7 @@ int zBTree<TK, TV>::Insert(const TK &key, size_t h, DATA_NODE<TK, TV> **&pD)
 		int i;
 		for (i = 0; i < KEY_MIN; ++i)
 		{
-			pRight->Key[i] = m_pRoot->Key[i + KEY_MIN + 1];
+			pRight->copyKey(i, m_pRoot, i + KEY_MIN + 1);
 			pRight->pChild[i] = m_pRoot->pChild[i + KEY_MIN + 1];
 		}
         pRight->pChild[KEY_MIN] = m_pRoot->pChild[CHILD_MAX - 1];	//copies the pointer to the last child node
@@ -853,13 +2053,13 @@ int zBTree<TK, TV>::Insert(const TK &key, size_t h, DATA_NODE<TK, TV> **&pD)
 	zBTreeNode<TK, TV> *p = hot;
 	if (!p)
     {	//If the tree is empty
-		m_pRoot = pNodeHeap->LockAlloc();
+		m_pRoot = allocNode();
 		if (!m_pRoot)
 			return -1;
 		new(m_pRoot) zBTreeNode <TK, TV>;
 
 		m_pRoot->parent = 0;
-		//	m_pRoot->Key[0] = pD;
+        m_pRoot->H[0] = h;
         pD = &(m_pRoot->Key[0]);	//returns the index position to insert
                                     //The root node is also a leaf node, and all pointers to children are set to 0
 		for (int i = 0; i <= KEY_MAX; ++i)
@@ -870,10 +2070,7 @@ int zBTree<TK, TV>::Insert(const TK &key, size_t h, DATA_NODE<TK, TV> **&pD)
 	}
 
     //If the tree not empty,inserts the data node at index+1 position of the leaf node
-    //p->insertKey(index + 1, pD);
-	for (int i = p->KeyNum - 1; i > index; --i)
-		p->Key[i + 1] = p->Key[i];
-    pD = &(p->Key[index + 1]);	//returns the index position to insert
+    pD = p->openKey(index + 1, h);	//returns the index position to insert
     ++p->KeyNum;
 	++Size;
 	return 0;
@@ -885,7 +2082,7 @@ bool zBTree<TK, TV>::splitChild(zBTreeNode <TK, TV> *pParent, int nChildIndex, z
 {
     //New node for the right sibling node after splitting.
     //The original node wil become the left sibling node after splitting
-	zBTreeNode <TK, TV> *pRightNode = pNodeHeap->LockAlloc();
+	zBTreeNode <TK, TV> *pRightNode = allocNode();
 	if (!pRightNode)
 		return false;
 	new(pRightNode) zBTreeNode <TK, TV>;
@@ -895,7 +2092,7 @@ bool zBTree<TK, TV>::splitChild(zBTreeNode <TK, TV> *pParent, int nChildIndex, z
 	int i;
     for (i = 0; i < KEY_MIN; ++i)//Copies the second half elements to the new right sibling node
 	{
-		pRightNode->Key[i] = pNode->Key[i + CHILD_MIN];
+		pRightNode->copyKey(i, pNode, i + CHILD_MIN);
 	}
 
     //If not leaf node,copies children node and updates their pointes to the parent
@@ -914,7 +2111,7 @@ bool zBTree<TK, TV>::splitChild(zBTreeNode <TK, TV> *pParent, int nChildIndex, z
 			pRightNode->pChild[i] = 0;
     pNode->KeyNum = KEY_MIN;  //Updates the amount of the keys of the left splitted child node(original node)
 
-    pParent->insertKey(nChildIndex, pNode->Key[KEY_MIN]);//Raises the middle node to the parent node
+    pParent->insertKey(nChildIndex, pNode, KEY_MIN);//Raises the middle node to the parent node
 	pParent->insertChild(nChildIndex + 1, pRightNode);
 	++pParent->KeyNum;  //更新父节点的关键字个数
 
@@ -922,7 +2119,8 @@ bool zBTree<TK, TV>::splitChild(zBTreeNode <TK, TV> *pParent, int nChildIndex, z
 }
 
 template<class TK, class TV>
-DATA_NODE<TK, TV> * zBTree<TK, TV>::Remove(const TK &key, size_t h)
+template<class K>
+DATA_NODE<TK, TV> * zBTree<TK, TV>::Remove(const K &key, size_t h)
 {
 
     //Finds the position of (key,h)
@@ -939,16 +2137,13 @@ DATA_NODE<TK, TV> * zBTree<TK, TV>::Remove(const TK &key, size_t h)
 		{
 			q = q->pChild[0];
 		}
-		p->Key[index] = q->Key[0];
-		//	p->key.put(n, q->key[0]);
+		p->copyKey(index, q, 0);
 		index = 0;
 		p = q;
 	}
 
     //Now the node to be deleted is located at leaf node. The child node Pointers of a leaf node are all null values and no need to be considered
-	int i = index;
-	for (; i < p->KeyNum - 1; ++i)
-		p->Key[i] = p->Key[i + 1];
+	p->removeKey(index);
 	--p->KeyNum;
 
     //After deleting,there may be underflow issue that need to be solved.
@@ -973,7 +2168,7 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 		if (!q->KeyNum)
 		{			
 			m_pRoot = q->pChild[0];
-			pNodeHeap->LockFree(q);
+			pNodePool->LockFree(q);
 			m_pRoot->parent = 0;
 		}
 		return;
@@ -995,7 +2190,7 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 	{
         //Move the corresponding key from the parent node to the 1st positon of the node
 		lc = p->pChild[n - 1];
-		q->insertKey(0, p->Key[n - 1]);
+		q->insertKey(0, p, n - 1);
 
         //if not a leaf node,moves the last child node of the left sibling node to the node as the first child node,and updates the parent node of the child node
 		if (q->pChild[0])
@@ -1006,7 +2201,7 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 		++q->KeyNum;
 
         //Moves the last key of the left sibling node to the parent node as a substitute for the moved key
-		p->Key[n - 1] = lc->Key[lc->KeyNum - 1];
+		p->copyKey(n - 1, lc, lc->KeyNum - 1);
 
 		--lc->KeyNum;
 		return;
@@ -1017,7 +2212,7 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 		rc = p->pChild[n + 1];
 
         //Moves the corresponding key from the parent node to the rightmost positon of the node
-		q->Key[q->KeyNum] = p->Key[n];
+		q->copyKey(q->KeyNum, p, n);
 		++q->KeyNum;
 
         //if not a leaf node,moves the firs child node of the right sibling node to the node as the last child node,and updates the parent node of the child node
@@ -1028,7 +2223,7 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 		}
 
         //Moves the first key of the right sibling node to the paren node as a substitute for the moved key
-		p->Key[n] = rc->Key[0];
+		p->copyKey(n, rc, 0);
 		//有兄弟节点中移除第一个关键字和孩子节点
 		rc->removeKey(0);
 		rc->removeChild(0);
@@ -1045,12 +2240,12 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 	{
 		lc = p->pChild[n - 1];
 		//把父节点对应关键字下移并入左节点
-		lc->Key[KEY_MIN] = p->Key[n - 1];
+		lc->copyKey(KEY_MIN, p, n - 1);
 		++lc->KeyNum;
 		//把本节点的关键字移入左节点
 		int i;
 		for (i = 0; i < q->KeyNum; ++i)
-			lc->Key[lc->KeyNum + i] = q->Key[i];
+			lc->copyKey(lc->KeyNum + i, q, i);
 		//如果是非叶子节点，把孩子节点指针也移入，同时修改子节点的父节点为左节点
 		if (q->pChild[0])
 			for (i = 0; i <= q->KeyNum; ++i)
@@ -1063,19 +2258,19 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 		p->removeKey(n - 1);
 		p->removeChild(n);
 		--p->KeyNum;
-		pNodeHeap->LockFree(q);
+		pNodePool->LockFree(q);
 	}
     //otherwise,merges the node with the right sibling node
     else
 	{
 		rc = p->pChild[n + 1];
 		//把父节点对应关键字下移并入本节点
-		q->Key[KEY_MIN - 1] = p->Key[n];
+		q->copyKey(KEY_MIN - 1, p, n);
 		++q->KeyNum;
 		//把右节点的关键字移入本节点
 		int i;
 		for (i = 0; i < rc->KeyNum; ++i)
-			q->Key[q->KeyNum + i] = rc->Key[i];
+			q->copyKey(q->KeyNum + i, rc, i);
 		//如果是非叶子节点，把孩子节点指针也移入，同时修改子节点的父节点为左节点
 		if (rc->pChild[0])
 			for (i = 0; i <= rc->KeyNum; ++i)
@@ -1088,7 +2283,7 @@ void zBTree<TK, TV>::solveUnderflow(zBTreeNode <TK, TV> *q)
 		p->removeKey(n);
 		p->removeChild(n + 1);
 		--p->KeyNum;
-		pNodeHeap->LockFree(rc);
+		pNodePool->LockFree(rc);
 	}
 
     //The number of children of the parent node decreases after merging
@@ -1131,38 +2326,57 @@ void zBTree<TK, TV>::recursive_clear(zBTreeNode <TK, TV> *pNode)
 		for (int i = 0; i <= pNode->KeyNum; ++i)
 			recursive_clear(pNode->pChild[i]);
 	}
-	pNodeHeap->LockFree(pNode);
+	pNodePool->LockFree(pNode);
 }
 
 template<class TK, class TV>
 zHash<TK, TV>::zHash()
 {
-    atomic_init(&Vistors,0);
     pHashFun = zHashFun;
-    Buckets = 256;//2**8,initial default number of buckets
+    if constexpr (std::is_same_v<KEY_VIEW, zNoView>)
+        pViewHashFun = 0;
+    else
+        pViewHashFun = zHashFun;
     this->LoadFactor=0.75;
-    this->Threshold = (size_t)((double)Buckets*LoadFactor);
-
-    pHeap = new zMemHeap<DATA_NODE<TK, TV>>(Threshold);
-	try {
-        pBTNodeHeap = new zMemHeap<zBTreeNode<TK, TV>>((Threshold + KEY_MIN - 1) / KEY_MIN);
-	}
-    catch(std::bad_alloc)
+    TABLE *pT = newTable(MIN_BUCKETS);//2**8,initial default number of buckets
+    if (!pT)
+        throw std::bad_alloc();
+    if (!Pool.Grow(pT->Threshold))
     {
-        delete pHeap;
+        freeTable(pT);
         throw std::bad_alloc();
     }
-    size_t SizeCount = Buckets * sizeof(ENTRY);
-    pBucket =(ENTRY*) malloc(SizeCount);
-    if (!pBucket)
+    RetiredNum = 0;
+    ResizeThreads = 0;
+    MinBuckets = MIN_BUCKETS;
+    CacheSize = 0;
+    atomic_init(&ClockHand, 0);
+    HasTTL = false;
+    atomic_init(&pWheel, (WHEEL_SLOT*)0);
+    atomic_init(&pSessions, (SESSION_SLOT*)0);
+    atomic_init(&SessionTop, 0);
+    atomic_init(&ReapedTick, (uint64_t)0);
+    ReaperRun = false;
+    for (int i = 0; i < STAT_SLOTS; ++i)
     {
-		delete pHeap;
-		delete pBTNodeHeap;
-        throw std::bad_alloc();
+        atomic_init(&StatSlots[i].Hits, 0);
+        atomic_init(&StatSlots[i].Misses, 0);
+        atomic_init(&StatSlots[i].ListToTree, 0);
+        atomic_init(&StatSlots[i].TreeToList, 0);
+        atomic_init(&StatSlots[i].Evictions, 0);
+        atomic_init(&StatSlots[i].Items, 0);
+        atomic_init(&StatSlots[i].Visitors, 0);
     }
-    PosMask = Buckets - 1;
-    MaskBits = zBitCount(PosMask);
-    DataCount = 0;
+    atomic_init(&Grows, 0);
+    atomic_init(&Shrinks, 0);
+    atomic_init(&ResizeNanos, 0);
+    atomic_init(&LastResizeNanos, 0);
+    atomic_init(&SamplePos, 0);
+    atomic_init(&WorkerNum, 0);
+    atomic_init(&RcuUsed, false);
+    pTab.store(pT, std::memory_order_relaxed);
+    pTabOld.store(0, std::memory_order_relaxed);
+    atomic_init(&DataCount, 0);
     FlagResize = false;
     Resizable = true;
     Countable = true;
@@ -1171,400 +2385,877 @@ zHash<TK, TV>::zHash()
     MaxSize=0xff;
     for(unsigned int i=1;i<sizeof(size_t);++i)
         MaxSize=(MaxSize<<8)|0xff;
-    initBucketList();
 }
 
 template<class TK, class TV>
-bool zHash<TK, TV>::upSize()
+typename zHash<TK, TV>::TABLE* zHash<TK, TV>::newTable(size_t Buckets)
 {
-	zMemHeap<DATA_NODE<TK, TV>>* pHeapOld = pHeap;
-	ENTRY* pBucketOld = pBucket;
-	size_t BucketsOld = Buckets;
-	size_t PosMaskOld = PosMask;
-	int MaskBitsOld = MaskBits;
-	size_t DataCountOld = DataCount;
-	zMemHeap<zBTreeNode<TK, TV>>* pBTNodeHeapOld = pBTNodeHeap;
-
-	pBucket = 0;
-	pHeap = 0;
-	pBTNodeHeap = 0;
-	Buckets = BucketsOld << 1;
-    Threshold = (size_t)((double)Buckets * LoadFactor);
+    TABLE *pT = new(nothrow) TABLE;
+    if (!pT)
+        return 0;
+    pT->Buckets = Buckets;
+    pT->PosMask = Buckets - 1;
+    pT->Threshold = (size_t)((double)Buckets * LoadFactor);
+    pT->LowWater = pT->Threshold >> 2;
+    //An eighth of the threshold is split among the slots,so a small table is counted item by item
+    pT->CountBatch = (int64_t)(pT->Threshold / (8 * STAT_SLOTS));
+    if (pT->CountBatch > COUNT_BATCH)
+        pT->CountBatch = COUNT_BATCH;
+    else if (pT->CountBatch < 1)
+        pT->CountBatch = 1;
+    pT->pBTNodePool = 0;
+    pT->pBucket = 0;
+    atomic_init(&pT->MovePos, 0);
+    atomic_init(&pT->MovedNum, 0);
 	try {
-        pHeap = new zMemHeap<DATA_NODE<TK, TV>>(Threshold);
-        pBTNodeHeap = new zMemHeap<zBTreeNode<TK, TV>>((Threshold + 1) >> 1);
-		
-		size_t SizeCount = Buckets * sizeof(ENTRY);
-		pBucket =(ENTRY*) malloc(SizeCount);
-		if (!pBucket)
+        pT->pBTNodePool = new zMemPool<zBTreeNode<TK, TV>>;
+        if (!pT->pBTNodePool->Grow(pT->Threshold / BTREE_POOL_DIV + 1))
+            throw std::bad_alloc();
+        pT->pBucket = (ENTRY*)::operator new(Buckets * sizeof(ENTRY), std::align_val_t(ZZG_CACHE_LINE), std::nothrow);
+        if (!pT->pBucket)
 			throw std::bad_alloc();
-		initBucketList();
-		PosMask = Buckets - 1;
-		MaskBits = zBitCount(PosMask);
-
-        //Scans and copies items from the old hash table
-		for (size_t i = 0; i < BucketsOld; ++i)
-		{
-            //if not empty
-			if (pBucketOld[i].p)
-			{
-                //if a linked list
-				if (pBucketOld[i].Size_Type > 0)
-				{
-					DATA_NODE<TK, TV>* pNext = (DATA_NODE<TK, TV>*)pBucketOld[i].p;
-					do
-					{
-						if (!inserCopyData(pNext))
-							throw std::bad_alloc();
-                    } while ((pNext = pNext->pNext));
-
-				}
-                //if a B-tree
-                else
-				{
-					DATA_NODE<TK, TV>** pBuf;
-					size_t Count = (pBucketOld[i].p)->Count();
-					pBuf = new(nothrow) DATA_NODE<TK, TV>* [Count];
-					if (!pBuf)
-						throw std::bad_alloc();
-					pBucketOld[i].p->FindAllData(pBuf);
-                    for (unsigned k = 0; k < Count; ++k)
-						if (!inserCopyData(pBuf[k]))
-							throw std::bad_alloc();
-				}
-			}
-		}
-
-        // Deletes the B-tree on the bucket entrances only after the capacity expansion is successfully complete
-		for (size_t i = 0; i < BucketsOld; ++i)
-		{
-			if (pBucketOld[i].p && pBucketOld[i].Size_Type <= 0)
-				delete pBucketOld[i].p;
-		}
-        //Free resources
-		delete pHeapOld;
-		delete pBTNodeHeapOld;
-		free(pBucketOld);
-		return true;
 	}
-	catch (std::bad_alloc)
+    catch (std::bad_alloc &)
 	{
-        //Restores the original state and return the error code
-
-        //If the new hash table has been established,cleans the occupied resources by it
-        //Cleans the B-trees first,because B-trees uses he memory heep pointed by pBTNodeHeap
-        if (pBucket)
-		{
-            //Free memory of B-Trees
-            for (unsigned int i = 0; i < Buckets; ++i)
-				if (pBucket[i].p && !pBucket[i].Size_Type)
-					delete pBucket[i].p;
-			free(pBucket);
-		}
-		if (pHeap)
-			delete pHeap;
-		if (pBTNodeHeap)
-			delete pBTNodeHeap;
-		pHeap = pHeapOld;
-		pBTNodeHeap = pBTNodeHeapOld;
-		pBucket = pBucketOld;
-		Buckets = BucketsOld;
-		PosMask = PosMaskOld;
-		MaskBits = MaskBitsOld;
-		DataCount = DataCountOld;
-		return false;
+		if (pT->pBTNodePool)
+			delete pT->pBTNodePool;
+        delete pT;
+        return 0;
 	}
+    initBucketList(pT);
+    return pT;
 }
 
 template<class TK, class TV>
-bool zHash<TK, TV>::pauseAndUpsize()
+void zHash<TK, TV>::freeTable(TABLE *pT)
 {
-    //If Resizable= true, checks and tries to expand the capacity
-	if (Resizable)
-	{
-        if (Buckets > MaxSize)
-			return false;
-        //Exits current visiting,then tries to lock.Otherwise,the threads trying to lock will deadlock because of waiting for each other to exit
-        //"acquire order" guarantees that atomic_fetch_sub_explicit() is executed before ResizeLock.Lock();
-        std::atomic_fetch_sub_explicit(&Vistors, 1, std::memory_order_acquire);
-		ResizeLock.Lock();
-
-        //Because of multithreading,checks again after locking to confirm if expansion is needed
-        //If Threshold is large enough,it means that probably another thread has expand the capacity,no need to expand again
-        if (DataCount >=Threshold)
-		{
-            //Sets FlagResize to true. Any thread will suspend its visiting when FlagResize is true
-			FlagResize = true;
-            //Release memory fence guarantees that "FlagResize = true" is executed before the first writes of the subsequent codes(C++ order)
-            //That is,it's guaranteed that FlagResize is set to true before the expansion is really started
-            std::atomic_thread_fence(std::memory_order_release);
-            //waits for all threads visiting to pause
-			waitVisitorsPause();
-
-            //If expansion fails
-            if (!upSize())
-			{
-                FlagResize = false;
-				ResizeLock.Unlock();
-                begin();	//Restart visiting
-				return false;
+    for (size_t i = 0; i < pT->Buckets; ++i)
+    {
+        ENTRY *pEntry = pT->pBucket + i;
+        if (!pEntry->p)
+            continue;
+        //Destructs the data nodes,so that the keys and values like std::string can free their memory.
+        //The data nodes of a moved bucket have been relinked into the new table,so they're left alone
+        constexpr bool NeedDestruct = !std::is_trivially_destructible_v<TK> || !std::is_trivially_destructible_v<TV>;
+        if (NeedDestruct && !pEntry->Moved)
+        {
+            if (pEntry->Size_Type > 0)
+            {
+                DATA_NODE<TK, TV> *pNext = (DATA_NODE<TK, TV>*)pEntry->p;
+                while (pNext)
+                {
+                    DATA_NODE<TK, TV> *pD = pNext;
+                    pNext = pNext->pNext;
+                    pD->~DATA_NODE();
+                }
             }
-            //Release memory fence guarantees that "FlagResize = false" is executed after the prior(C++ codes order) reads/writes
-            std::atomic_thread_fence(std::memory_order_release);
-			FlagResize = false;
-		}
-		ResizeLock.Unlock();
-        begin();	//Restart visiting
-		return true;
-	}
-    else    //If the hash table is  not resizeable
-		return false;
-
+            else
+            {
+                size_t Count = pEntry->p->Count();
+                DATA_NODE<TK, TV> **pBuf = new(nothrow) DATA_NODE<TK, TV>*[Count];
+                if (pBuf)
+                {
+                    pEntry->p->FindAllData(pBuf);
+                    for (size_t k = 0; k < Count; ++k)
+                        pBuf[k]->~DATA_NODE();
+                    delete[] pBuf;
+                }
+            }
+        }
+        //The tree nodes are freed together with pBTNodePool
+        if (pEntry->Size_Type <= 0)
+            delete pEntry->p;
+    }
+    //The memory of the data nodes belongs to the pool
+    delete pT->pBTNodePool;
+    ::operator delete(pT->pBucket, std::align_val_t(ZZG_CACHE_LINE));
+    delete pT;
 }
 
 template<class TK, class TV>
-bool zHash<TK, TV>::listToBTree(ENTRY * pT)
+bool zHash<TK, TV>::startResize(TABLE *pCur, bool Grow)
 {
-    //Keeps the old head of the linked list for restoring on failure
-    DATA_NODE<TK, TV>* pOld = (DATA_NODE<TK, TV>*) pT->p;
-    DATA_NODE<TK, TV>*pNext = pOld;
-    pT->p = new (nothrow) zBTree<TK, TV>(pBTNodeHeap);
-    if(!pT->p)
+    //Another thread is starting or finishing resizing.Never waits here,because the caller is visiting the hash table
+    if (!ResizeLock.TryLock())
+        return true;
+    //Because of multithreading,checks again after locking. If the current table has changed or the old table still exists,
+    //another thread has done it
+    if (pTab.load(std::memory_order_relaxed) != pCur || pTabOld.load(std::memory_order_relaxed))
+    {
+        ResizeLock.Unlock();
+        return true;
+    }
+    size_t Buckets = Grow ? pCur->Buckets << 1 : pCur->Buckets >> 1;
+    if (Grow ? Buckets > MaxSize : Buckets < MinBuckets)
     {
-        pT->p=(zBTree<TK, TV>*)pOld;
+        ResizeLock.Unlock();
         return false;
     }
-	DATA_NODE<TK, TV>**tmp;
-	do {
-        //It's guaranteed that There are enough B-Tree node for allocation
-        pT->p->Insert(pNext->key, pNext->h, tmp);
-        *tmp = pNext;	//Inserts the pointer to data node
-    } while ((pNext = pNext->pNext));
-	pT->Size_Type = 0;
+    TABLE *pNew = newTable(Buckets);
+    if (!pNew)
+    {
+        ResizeLock.Unlock();
+        return false;
+    }
+    if (Grow)
+    {
+        //The data nodes of the old table are relinked into the new one,so the pool only grows by the difference of the thresholds
+        if (Pool.GetCapacity() < pNew->Threshold && !Pool.Grow(pNew->Threshold - Pool.GetCapacity()))
+        {
+            freeTable(pNew);
+            ResizeLock.Unlock();
+            return false;
+        }
+    }
+    //Closes the last segment of the pool if the rest is enough for the smaller table. Its data nodes are copied out by moveBucket()
+    else if (Pool.GetCapacity() - Pool.GetLastCapacity() >= pNew->Threshold)
+        Pool.CloseLast();
+    //The old table must be published before the new one,because the visiting threads read pTab first and then pTabOld.
+    //A thread which sees the new table must see the old table too
+    pTabOld.store(pCur, std::memory_order_release);
+    pTab.store(pNew, std::memory_order_release);
+    ResizeStart = std::chrono::steady_clock::now();
+	ResizeLock.Unlock();
+
+    //Starts the workers for a large table. If a worker can't be started,the visiting threads still move the buckets
+    if (pCur->Buckets >= PARALLEL_MOVE_MIN)
+    {
+        for (uint32_t i = 0; i < ResizeThreads; ++i)
+        {
+            std::atomic_fetch_add_explicit(&WorkerNum, 1, std::memory_order_relaxed);
+            try {
+                std::thread(&zHash<TK, TV>::resizeWorker, this).detach();
+            }
+            catch (...)
+            {
+                std::atomic_fetch_sub_explicit(&WorkerNum, 1, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
     return true;
 }
 
 template<class TK, class TV>
-void zHash<TK, TV>::treeToList(ENTRY * pT)
+void zHash<TK, TV>::helpResize(size_t Steps)
 {
-	size_t count = pT->p->Count();
-	DATA_NODE<TK, TV>* *pBuf = new DATA_NODE<TK, TV>*[count];
-    //Gets pointers to all data nodes
-    pT->p->FindAllData(pBuf);
-    //Frees the resources of the B-Tress
-    pT->p->Clear();
-    delete pT->p;
-    //Attaches data nodes to the bucket
-	pT->p = (zBTree<TK, TV> *)pBuf[0];
-	pT->Size_Type = count;
-	size_t i = 1;
-	for (; i < count; ++i)
-		pBuf[i - 1]->pNext = pBuf[i];
-	pBuf[i - 1]->pNext = 0;
-    delete[] pBuf;
-
+    //Reads pTab before pTabOld. See startResize()
+    TABLE *pNew = pTab.load(std::memory_order_acquire);
+    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+    if (!pOld || pOld == pNew)
+        return;
+    moveChunks(pOld, pNew, Steps, 1);
 }
 
 template<class TK, class TV>
-bool zHash<TK, TV>::inserCopyData(DATA_NODE<TK, TV>* pSrc)
+bool zHash<TK, TV>::moveChunks(TABLE *pOld, TABLE *pNew, size_t Chunk, size_t MaxChunks)
 {
-    DATA_NODE<TK, TV>*pData = pHeap->LockAlloc();	//allocates data nodes
-    new(pData) DATA_NODE<TK, TV>;	//initializes data node
-
-    //The hash is related to the size of the bucket table,so it should be recalculated after expantion
-    pData->h = pHashFun(pSrc->key, MaskBits);
-	pData->key = pSrc->key;
-	pData->value = pSrc->value;
-
-    size_t pos = pData->h&(size_t)PosMask;	//gets the index position of the bucket
-    if (!pBucket[pos].p)	//if the bucket is empty,attaches the data node
-	{
-		pBucket[pos].p = (zBTree<TK, TV> *)pData;
-        pBucket[pos].Size_Type = 1;	//"1" means a linked list in the bucket
-        pData->pNext = 0;	//"0" identifies the end of the linked list
-	}
-    else if (pBucket[pos].Size_Type > 0)	//If it the bucket contains a linked list
-	{
-        //Directly inserts the data node into the linked list if the size of the linked list is less than MAX_LINKEDLIST_SIZE
-        if (pBucket[pos].Size_Type < MAX_LINKEDLIST_SIZE)
-		{
-			pData->pNext = (DATA_NODE<TK, TV>*)pBucket[pos].p;
-			pBucket[pos].p = (zBTree<TK, TV> *)pData;
-			++pBucket[pos].Size_Type;
-		}
-        else    //If the size of the linked list not less than MAX_LINKEDLIST_SIZE,converts it into a B-Tree
-		{
-            //retursn false on failure
-            if(!listToBTree(pBucket + pos))
-                return false;
-			DATA_NODE<TK, TV>**tmp;
-            //Inserts the data node
-			if (pBucket[pos].p->Insert(pData->key, pData->h, tmp))
-				return false;
-			*tmp = pData;
-		}
-	}
-    else    //If the bucket contains a B-Tree
-	{
-		DATA_NODE<TK, TV>**tmp;
-		if (pBucket[pos].p->Insert(pData->key, pData->h, tmp))
-			return false;
-		*tmp = pData;
-	}
-	return true;
+    for (size_t n = 0; n < MaxChunks; ++n)
+    {
+        //Claims a chunk.Each chunk is moved by only one thread,so the threads work on different cache lines of both tables
+        size_t Pos = std::atomic_fetch_add_explicit(&pOld->MovePos, Chunk, std::memory_order_relaxed);
+        if (Pos >= pOld->Buckets)
+            return false;
+        size_t End = Pos + Chunk < pOld->Buckets ? Pos + Chunk : pOld->Buckets;
+        for (; Pos < End; ++Pos)
+        {
+            //Moving may fail for lack of memory.The bucket will be moved by the thread inserting into it,or by grow()
+            if (moveBucket(pOld, pNew, Pos) == 1)
+            {
+                finishResize(pOld);
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 template<class TK, class TV>
-int zHash<TK, TV>::insertKey(ENTRY* &pEntry, size_t h, TK &Key, DATA_NODE<TK, TV>* &pRet)
+void zHash<TK, TV>::resizeWorker()
 {
-INSERT_BEGIN:
-    if (!pEntry->p)	//If the bucket is empty
-	{
-        pRet = pHeap->LockAlloc();	//allocates a data node
-
-        //If the allocation fails,tries to expand the capacity.
-        //tries inserting again after successful expansion
-        if (!pRet)
-		{
-            if (pauseAndUpsize())
-            {
-                //The hash is related to the size of the bucket table,so it should be recalculated after expantion
-                h = pHashFun(Key, MaskBits);
-                //Be careful,do not forget to unlock the old bucket before changing into the new bucket
-                pEntry->lock.WUnlock();
-                pEntry = pBucket + (h&(size_t)PosMask);
-                pEntry->lock.WLock();	//Locks the new bucket
-				goto INSERT_BEGIN;
-			}
-			else
-				return -1;
-		}
-        new(pRet) DATA_NODE<TK, TV>;	//Initializes the data node
-		pRet->h = h;
-		pRet->key = Key;
+    begin();
+    //Reads pTab before pTabOld. See startResize()
+    TABLE *pNew = pTab.load(std::memory_order_acquire);
+    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+    if (pOld && pOld != pNew)
+        moveChunks(pOld, pNew, MOVE_CHUNK, ~(size_t)0);
+    end();
+    //It's the last access to the hash table.close() waits for it
+    std::atomic_fetch_sub_explicit(&WorkerNum, 1, std::memory_order_release);
+}
 
-		pEntry->p = (zBTree<TK, TV> *) pRet;
-        pEntry->Size_Type = 1;	// Linked list
-        pRet->pNext = 0;	//identifies end of the list
-	}
-    else if (pEntry->Size_Type > 0)	//If the bucket contains a linked list
-	{
-        //Checks if the bucket contains the key.If yes,returns
-		for (DATA_NODE<TK, TV>*pNext = (DATA_NODE<TK, TV>*)pEntry->p; pNext; pNext = pNext->pNext)
-		{
-			if (h == pNext->h&&Key == pNext->key)
-			{
-				pRet = pNext;
-				return 1;
-			}
-		}
-        pRet = pHeap->LockAlloc();
-        if (!pRet)
-		{
-            if (pauseAndUpsize())
+template<class TK, class TV>
+int zHash<TK, TV>::moveBucket(TABLE *pOld, TABLE *pNew, size_t Pos)
+{
+    ENTRY *pEntry = pOld->pBucket + Pos;
+    if (pEntry->Moved)
+        return SUCCESS;
+    pEntry->WLock();
+    //Because of multithreading,checks again after locking
+    if (pEntry->Moved)
+    {
+        pEntry->WUnlock();
+        return SUCCESS;
+    }
+    size_t Count = 0;
+    //pBuf[0...Count-1] are the data nodes of the bucket,and pBuf[Count...2*Count-1] are the ones linked into the new table(see below).
+    //A linked list usually contains no more than MAX_LINKEDLIST_SIZE items,so the local buffer is enough.But it's longer if
+    //listToBTree() has failed,and then the buffer is allocated like that of a B-tree
+    DATA_NODE<TK, TV> *ListBuf[2 * MAX_LINKEDLIST_SIZE];
+    DATA_NODE<TK, TV> **pBuf = ListBuf;
+    if (pEntry->p)
+    {
+        Count = pEntry->Size_Type > 0 ? pEntry->Size_Type : pEntry->p->Count();
+        if (pEntry->Size_Type <= 0 || Count > MAX_LINKEDLIST_SIZE)
+        {
+            pBuf = new(nothrow) DATA_NODE<TK, TV>*[2 * Count];
+            if (!pBuf)
             {
-                //The hash is related to the size of the bucket table,so it should be recalculated after expantion
-                h = pHashFun(Key, MaskBits);
-                //Be careful,do not forget to unlock the old bucket before changing into the new bucket
-                pEntry->lock.WUnlock();
-                pEntry = pBucket + (h&(size_t)PosMask);
-                pEntry->lock.WLock();	//Locks the new bucket
-				goto INSERT_BEGIN;
-			}
-			else
-				return -1;
-		}
-        new(pRet) DATA_NODE<TK, TV>;	//Initializes the node
-		pRet->h = h;
-		pRet->key = Key;
-		pRet->pNext = (DATA_NODE<TK, TV>*)pEntry->p;
-		pEntry->p = (zBTree<TK, TV> *)pRet;
-        ++pEntry->Size_Type;	//Increases the size of the bucket
-
-        //If the size greater than MAX_LINKEDLIST_SIZE,converts it into a B-tree
-        if (pEntry->Size_Type >= MAX_LINKEDLIST_SIZE)
-            if(!listToBTree(pEntry))
+                pEntry->WUnlock();
                 return ERR_MEMORY;
-	}
-    else    //If the bucket contains a B-tree
-	{
-
-        // Pre-allocation of data nodes
-        // Be careful here. The execution order of LockAlloc() and pEntry->p->Insert(Key, h, tmp) is important.
-        //when you call pHeap->LockAlloc() after success calling of pEntry->p->Insert(), if there is insufficient memory,and the cpacity is expanded,
-        //an error will occur. Because the size of inner B-tree increases after a successful calling pEntry->p->Insert(), but the corresponding data
-        //node has not been allocated by pHeap->LockAlloc() and filled data. That is,in such case, the BTree pointed by p contains a "incomplete" item which
-        //doesn't have data
-        // There will be an error
-        pRet = pHeap->LockAlloc();
-        //If the allocation fails,tries to expand the capacity.
-        //tries inserting again after successful expansion
-        if (!pRet)
+            }
+        }
+        if (pEntry->Size_Type > 0)    //if a linked list
         {
-            int index;
+            size_t k = 0;
+            for (DATA_NODE<TK, TV> *pNext = (DATA_NODE<TK, TV>*)pEntry->p; pNext && k < Count; pNext = pNext->pNext)
+                pBuf[k++] = pNext;
+        }
+        else    //if a B-tree
+            pEntry->p->FindAllData(pBuf);
+    }
+    DATA_NODE<TK, TV> **pMoved = pBuf + Count;
+    size_t k = 0;
+
+    //The data nodes are relinked into the new table rather than copied. The hash is stored in the data node and doesn't depend on
+    //the size of the table,so neither the key nor the value is touched.
+    //The readers without lock which are still walking the old linked list may follow the new links,but they either find the same
+    //data node which is still valid,or find the version of the old bucket changed and search again
+    for (; k < Count; ++k)
+    {
+        DATA_NODE<TK, TV> *pData = pBuf[k];
+        //A data node in the closed segment is replaced by its copy,and is retired after the old bucket is unlocked.
+        //It's locked while being copied,so an update without the bucket lock either goes into the copy or finds it removed and searches again.
+        //If no memory can be allocated,or the item is locked by LockItem(),the data node is kept,and the segment is reopened when the old table is freed.
+        //The value is copied rather than moved,because VisitRcu() may be reading the old data node without any lock until it's freed.
+        //A value which can't be copied is moved only if VisitRcu() has never been called(see visitRcu()),otherwise the data node is kept
+        if constexpr (std::is_copy_constructible_v<TK> && std::is_move_constructible_v<TV>)
+        {
+            bool Movable = std::is_copy_constructible_v<TV>;
+            if (!Movable && Pool.InClosed(pData))
+            {
+                //Pairs with the fence in visitRcu().The new table has been published before,so either this thread sees RcuUsed,
+                //or VisitRcu() sees the resizing and reads with the bucket locked
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                Movable = !RcuUsed.load(std::memory_order_relaxed);
+            }
+            if (Movable && Pool.InClosed(pData) && !pData->Pinned)
+            {
+                DATA_NODE<TK, TV> *pCopy = Pool.LockAlloc();
+                if (pCopy)
+                {
+                    pData->slock.WLock();
+                    if constexpr (std::is_copy_constructible_v<TV>)
+                        new(pCopy) DATA_NODE<TK, TV>(pData->h, pData->key, pData->value);
+                    else
+                        new(pCopy) DATA_NODE<TK, TV>(pData->h, pData->key, std::move(pData->value));
+                    pCopy->Expire.store(pData->Expire.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    pData->Removed = true;
+                    pData->slock.WUnlock();
+                    pData = pCopy;
+                }
+            }
+        }
+        pMoved[k] = pData;
+        ENTRY *pNewEntry = pNew->pBucket + (pData->h & pNew->PosMask);
+        pNewEntry->WLock();
+        //Linking fails only if the new bucket is a B-tree and the B-tree node pool can't grow
+        bool Linked = linkData(pNew, pNewEntry, pData);
+        pNewEntry->WUnlock();
+        if (!Linked)
+            goto UNDO;
+    }
+
+    //The old bucket keeps its pointers until the old table is freed,because the readers without lock may still be reading them.
+    //A thread which finds the bucket empty without locking it checks Moved afterwards
+    pEntry->Moved = true;
+    pEntry->WUnlock();
+    //Only the data nodes replaced by their copies are retired here. The others are in the new table now,
+    //and may have been removed and retired by another thread since the old bucket was unlocked
+    for (size_t k = 0; k < Count; ++k)
+    {
+        if (pMoved[k] != pBuf[k])
+            retireData(pBuf[k]);
+    }
+    if (pBuf != ListBuf)
+        delete[] pBuf;
+    if (std::atomic_fetch_add_explicit(&pOld->MovedNum, 1, std::memory_order_acq_rel) + 1 == pOld->Buckets)
+        return 1;
+    return SUCCESS;
+
+UNDO:	//Takes the data nodes out of the new table again and keeps the old bucket,so that no item is lost.
+    //No other thread can see them in the new table,because the old bucket is still write locked and not marked as moved
+    for (size_t i = 0; i < k; ++i)
+    {
+        ENTRY *pNewEntry = pNew->pBucket + (pMoved[i]->h & pNew->PosMask);
+        pNewEntry->WLock();
+        unlinkData(pNewEntry, pMoved[i]);
+        pNewEntry->WUnlock();
+    }
+    //The copies which have replaced the data nodes in the closed segment are kept,because they have replaced the originals in the bucket,
+    //which are marked removed and retired below
+    if (pEntry->Size_Type > 0)	//if a linked list,relinks it,because linkData() has changed the links
+    {
+        for (size_t i = k + 1; i < Count; ++i)
+            pMoved[i] = pBuf[i];
+        for (size_t i = 0; i < Count; ++i)
+            pMoved[i]->pNext = i + 1 < Count ? pMoved[i + 1] : 0;
+        pEntry->p = (zBTree<TK, TV>*)pMoved[0];
+    }
+    else    //if a B-tree,only the pointers to the copies are replaced
+    {
+        for (size_t i = 0; i <= k; ++i)
+        {
+            if (pMoved[i] == pBuf[i])
+                continue;
+            int Index;
+            zBTreeNode<TK, TV> *pBTNode = pEntry->p->Search(pBuf[i]->key, pBuf[i]->h, Index);
+            pBTNode->Key[Index] = pMoved[i];
+        }
+    }
+    pEntry->WUnlock();
+    for (size_t i = 0; i <= k; ++i)
+    {
+        if (pMoved[i] != pBuf[i])
+            retireData(pBuf[i]);
+    }
+    if (pBuf != ListBuf)
+        delete[] pBuf;
+    return ERR_MEMORY;
+}
+
+template<class TK, class TV>
+void zHash<TK, TV>::finishResize(TABLE *pOld)
+{
+    //Exits current visiting before waiting for the other visitors,otherwise it would wait for itself
+    end();
+    ResizeLock.Lock();
+    //Sets FlagResize to true. Any thread will suspend its visiting when FlagResize is true
+    FlagResize = true;
+    //Full memory fence.It pairs with the fetch_add in begin(),so either the visitor sees FlagResize or this thread sees the visitor
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    //All buckets have been moved,so only the operations in progress are waited for. They may still read the old table
+	waitVisitorsPause();
+    pTabOld.store(0, std::memory_order_release);
+    bool Shrunk = pOld->Buckets > pTab.load(std::memory_order_relaxed)->Buckets;
+    freeTable(pOld);
+    uint64_t Nanos = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ResizeStart).count();
+    LastResizeNanos.store(Nanos, std::memory_order_relaxed);
+    ResizeNanos.store(ResizeNanos.load(std::memory_order_relaxed) + Nanos, std::memory_order_relaxed);
+    std::atomic_fetch_add_explicit(Shrunk ? &Shrinks : &Grows, 1, std::memory_order_relaxed);
+    if (Shrunk)
+    {
+        //No reader without lock is in progress while the hash table pauses,so the retired data nodes are freed without waiting.
+        //The closed segment of the pool can be returned to the heap only after the data nodes copied out of it are freed
+        RetireLock.Lock();
+        freeData(Retired, RetiredNum);
+        RetiredNum = 0;
+        RetireLock.Unlock();
+        Pool.Trim();
+    }
+    //Release memory fence guarantees that "FlagResize = false" is executed after the prior(C++ codes order) reads/writes
+    std::atomic_thread_fence(std::memory_order_release);
+    FlagResize = false;
+	ResizeLock.Unlock();
+    begin();	//Restart visiting
+    //The items may have been deleted faster than the buckets were moved.Keeps shrinking until the load is above the low-water mark
+    TABLE *pT = pTab.load(std::memory_order_acquire);
+    if (Shrunk && count() < pT->LowWater && pT->Buckets > MinBuckets)
+        startResize(pT, false);
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::grow(TABLE *pT)
+{
+    //The retired data nodes occupy the heap until they are freed
+    if (flushRetired())
+        return true;
+    if (!Resizable)
+        return false;
+    //pT has become the old table.The bucket will be moved into the new table before inserting again
+    if (pTab.load(std::memory_order_acquire) != pT)
+        return true;
+    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+    if (pOld && pOld != pT)
+    {
+        //The new table is full before all buckets have been moved.It's rare,because each insertion moves buckets too.
+        //Moves all the rest buckets,so that the table can be expanded again.The threads which get here at the same time claim
+        //different chunks first,then each checks all buckets for the ones which failed to be moved or are still being moved
+        if (moveChunks(pOld, pT, MOVE_CHUNK, ~(size_t)0))
+            return true;
+        for (size_t i = 0; i < pOld->Buckets; ++i)
+        {
+            int ret = moveBucket(pOld, pT, i);
+            if (ret == ERR_MEMORY)
+                return false;
+            if (ret == 1)
+            {
+                finishResize(pOld);
+                break;
+            }
+        }
+        //If another thread has moved the last bucket,it's finishing resizing.The caller will wait for it in begin()
+        return true;
+    }
+    return startResize(pT, true);
+}
+
+template<class TK, class TV>
+template<class F>
+size_t zHash<TK, TV>::ParallelForEach(uint32_t Threads, F &&Fun)
+{
+    begin();
+    size_t Units = pTab.load(std::memory_order_acquire)->Buckets;
+    end();
+    std::atomic_size_t Next;
+    atomic_init(&Next, 0);
+    std::atomic_size_t Count;
+    atomic_init(&Count, 0);
+    std::vector<std::thread> Scanners;
+    for (uint32_t i = 1; i < Threads; ++i)
+    {
+        try {
+            Scanners.emplace_back([&]() {
+                std::atomic_fetch_add_explicit(&Count, scanChunks(Units, Next, Fun), std::memory_order_relaxed);
+            });
+        }
+        catch (...)
+        {
+            //The chunks are claimed dynamically,so the threads started are enough
+            break;
+        }
+    }
+    size_t Ret = scanChunks(Units, Next, Fun);
+    for (std::thread &t : Scanners)
+        t.join();
+    return Ret + Count.load(std::memory_order_relaxed);
+}
+
+template<class TK, class TV>
+template<class F>
+size_t zHash<TK, TV>::scanChunks(size_t Units, std::atomic_size_t &Next, F &Fun)
+{
+    SCAN_BUF Items;
+    std::vector<DATA_NODE<TK, TV>*> Nodes;
+    size_t Count = 0;
+    do {
+        size_t Pos = std::atomic_fetch_add_explicit(&Next, SCAN_CHUNK, std::memory_order_relaxed);
+        if (Pos >= Units)
+            break;
+        size_t End = Pos + SCAN_CHUNK < Units ? Pos + SCAN_CHUNK : Units;
+        Items.clear();
+        //The old table can't be freed and no new resizing can start before end(),so the tables read here stay valid
+        begin();
+        helpResize(MOVE_STEP);
+        try {
+            for (; Pos < End; ++Pos)
+            {
+                size_t Size = Items.size();
+                do {
+                    //Reads pTab before pTabOld. See startResize()
+                    TABLE *pT = pTab.load(std::memory_order_acquire);
+                    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+                    if (pOld && pOld != pT)
+                    {
+                        if (collectItems(pOld, pT, Units - 1, Pos, Items, Nodes))
+                            break;
+                    }
+                    else if (collectItems(pT, 0, Units - 1, Pos, Items, Nodes))
+                        break;
+                    //Resizing has started meanwhile.Copies the bucket again from both tables
+                    Items.erase(Items.begin() + Size, Items.end());
+                } while (true);
+            }
+        }
+        catch (...)
+        {
+            end();
+            throw;
+        }
+        end();
+        for (std::pair<TK, TV> &Item : Items)
+            Fun((const TK&)Item.first, (const TV&)Item.second);
+        Count += Items.size();
+    } while (true);
+    return Count;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::collectItems(TABLE *pT, TABLE *pNew, size_t Mask, size_t Val, SCAN_BUF &Items, std::vector<DATA_NODE<TK, TV>*> &Nodes)
+{
+    if (pT->PosMask >= Mask)
+    {
+        //The hash class is split into several buckets,and all items of these buckets belong to it
+        for (size_t Pos = Val; Pos < pT->Buckets; Pos += Mask + 1)
+        {
+            if (!collectBucket(pT->pBucket + Pos, 0, 0, Items, Nodes)
+                && (!pNew || !collectItems(pNew, 0, pT->PosMask, Pos, Items, Nodes)))
+                return false;
+        }
+    }
+    else
+    {
+        //The bucket holds the items of several hash classes
+        size_t Pos = Val & pT->PosMask;
+        if (!collectBucket(pT->pBucket + Pos, Mask, Val, Items, Nodes)
+            && (!pNew || !collectItems(pNew, 0, Mask, Val, Items, Nodes)))
+            return false;
+    }
+    return true;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::collectBucket(ENTRY *pEntry, size_t Mask, size_t Val, SCAN_BUF &Items, std::vector<DATA_NODE<TK, TV>*> &Nodes)
+{
+    pEntry->lock.RLock();
+    if (pEntry->Moved)
+    {
+        pEntry->lock.RUnlock();
+        return false;
+    }
+    try {
+        DATA_NODE<TK, TV> **pBuf = 0;
+        size_t Count = 0;
+        if (!pEntry->p)
+            ;
+        else if (pEntry->Size_Type > 0)	//if a linked list
+        {
+            //The data nodes can't be deleted while the bucket is read locked
+            if (Nodes.size() < pEntry->Size_Type)
+                Nodes.resize(pEntry->Size_Type);
+            pBuf = Nodes.data();
+            for (DATA_NODE<TK, TV> *pD = (DATA_NODE<TK, TV>*)pEntry->p; pD; pD = pD->pNext)
+                pBuf[Count++] = pD;
+        }
+        else    //if a B-tree
+        {
+            Count = pEntry->p->Count();
+            if (Nodes.size() < Count)
+                Nodes.resize(Count);
+            pBuf = Nodes.data();
+            pEntry->p->FindAllData(pBuf);
+        }
+        for (size_t i = 0; i < Count; ++i)
+        {
+            DATA_NODE<TK, TV> *pD = pBuf[i];
+            if ((pD->h & Mask) != Val || expired(pD))
+                continue;
+            //The value may be updated without the bucket lock,so it's read with the sequence lock
+            int Ver;
+            do {
+                Ver = pD->slock.ReadBegin();
+                Items.emplace_back(pD->key, pD->value);
+                if (!pD->slock.ReadRetry(Ver))
+                    break;
+                Items.pop_back();
+            } while (true);
+        }
+    }
+    catch (...)
+    {
+        pEntry->lock.RUnlock();
+        throw;
+    }
+    pEntry->lock.RUnlock();
+    return true;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::HelpResize(size_t Steps)
+{
+    begin();
+    helpResize(Steps);
+    bool ret = pTabOld.load(std::memory_order_acquire) != 0;
+    end();
+    return ret;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::listToBTree(TABLE *pT, ENTRY * pEntry)
+{
+    //Keeps the old head of the linked list for restoring on failure
+    DATA_NODE<TK, TV>* pOld = (DATA_NODE<TK, TV>*) pEntry->p;
+    DATA_NODE<TK, TV>*pNext = pOld;
+    pEntry->p = new (nothrow) zBTree<TK, TV>(pT->pBTNodePool);
+    if(!pEntry->p)
+    {
+        pEntry->p=(zBTree<TK, TV>*)pOld;
+        return false;
+    }
+	DATA_NODE<TK, TV>**tmp;
+	do {
+        //If the B-tree node pool can't grow,the partial B-tree is freed and the linked list is kept
+        if (pEntry->p->Insert(pNext->key, pNext->h, tmp))
+        {
+            pEntry->p->Clear();
+            delete pEntry->p;
+            pEntry->p = (zBTree<TK, TV>*)pOld;
+            return false;
+        }
+        *tmp = pNext;	//Inserts the pointer to data node
+    } while ((pNext = pNext->pNext));
+	pEntry->Size_Type = 0;
+    std::atomic_fetch_add_explicit(&StatSlots[zThreadIndex() & (STAT_SLOTS - 1)].ListToTree, 1, std::memory_order_relaxed);
+    return true;
+}
+
+template<class TK, class TV>
+void zHash<TK, TV>::treeToList(ENTRY * pT)
+{
+	size_t count = pT->p->Count();
+	DATA_NODE<TK, TV>* *pBuf = new DATA_NODE<TK, TV>*[count];
+    //Gets pointers to all data nodes
+    pT->p->FindAllData(pBuf);
+    //Frees the resources of the B-Tress
+    pT->p->Clear();
+    delete pT->p;
+    //Attaches data nodes to the bucket
+	pT->p = (zBTree<TK, TV> *)pBuf[0];
+	pT->Size_Type = count;
+	pT->Head = fingerprint(pBuf[0]->h);
+	size_t i = 1;
+	for (; i < count; ++i)
+		pBuf[i - 1]->pNext = pBuf[i];
+	pBuf[i - 1]->pNext = 0;
+    delete[] pBuf;
+    std::atomic_fetch_add_explicit(&StatSlots[zThreadIndex() & (STAT_SLOTS - 1)].TreeToList, 1, std::memory_order_relaxed);
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::linkData(TABLE *pT, ENTRY *pEntry, DATA_NODE<TK, TV>* pData)
+{
+    if (!pEntry->p)	//if the bucket is empty,attaches the data node
+	{
+        pData->pNext = 0;	//"0" identifies the end of the linked list
+        //The readers without lock may see the data node as soon as it's linked,so it must be filled before
+        std::atomic_thread_fence(std::memory_order_release);
+        pEntry->Head = fingerprint(pData->h);
+		pEntry->p = (zBTree<TK, TV> *)pData;
+        pEntry->Size_Type = 1;	//"1" means a linked list in the bucket
+	}
+    else if (pEntry->Size_Type > 0)	//If it the bucket contains a linked list
+	{
+        pData->pNext = (DATA_NODE<TK, TV>*)pEntry->p;
+        std::atomic_thread_fence(std::memory_order_release);
+        pEntry->Head = fingerprint(pData->h);
+        pEntry->p = (zBTree<TK, TV> *)pData;
+        ++pEntry->Size_Type;
+        //If the size reaches MAX_LINKEDLIST_SIZE,converts it into a B-tree.
+        //If converting fails,the linked list is kept.It still works,just a little slower
+        if (pEntry->Size_Type >= MAX_LINKEDLIST_SIZE)
+            listToBTree(pT, pEntry);
+	}
+    else    //If the bucket contains a B-Tree
+	{
+		DATA_NODE<TK, TV>**tmp;
+		if (pEntry->p->Insert(pData->key, pData->h, tmp))
+			return false;
+		*tmp = pData;
+	}
+	return true;
+}
+
+template<class TK, class TV>
+void zHash<TK, TV>::unlinkData(ENTRY *pEntry, DATA_NODE<TK, TV> *pData)
+{
+    if (pEntry->Size_Type > 0)	//If linked list
+    {
+        DATA_NODE<TK, TV> *pPre = 0;
+        DATA_NODE<TK, TV> *pD = (DATA_NODE<TK, TV>*)pEntry->p;
+        for (; pD && pD != pData; pD = pD->pNext)
+            pPre = pD;
+        if (!pD)
+            return;
+        if (!pPre)
+            pEntry->p = (zBTree<TK, TV> *)pD->pNext;
+        else
+            pPre->pNext = pD->pNext;
+        if (!(--pEntry->Size_Type))
+            pEntry->p = 0;
+        else
+            pEntry->Head = fingerprint(((DATA_NODE<TK, TV>*)pEntry->p)->h);
+    }
+    else if (pEntry->p)	//If B-tree
+    {
+        pEntry->p->Remove(pData->key, pData->h);
+        if (pEntry->p->Count() < MIN_BTREE_SIZE)
+            treeToList(pEntry);
+    }
+}
+
+template<class TK, class TV>
+template<class K, class... Args>
+int zHash<TK, TV>::insertKey(TABLE *pT, ENTRY* pEntry, size_t h, K &&Key, DATA_NODE<TK, TV>* &pRet, Args&&... args)
+{
+    if (!pEntry->p)	//If the bucket is empty
+	{
+        pRet = Pool.LockAlloc();	//allocates a data node
+        if (!pRet)
+            return ERR_MEMORY;
+        new(pRet) DATA_NODE<TK, TV>(h, std::forward<K>(Key), std::forward<Args>(args)...);	//Initializes the data node
+        linkData(pT, pEntry, pRet);
+	}
+    else if (pEntry->Size_Type > 0)	//If the bucket contains a linked list
+	{
+        //Checks if the bucket contains the key.If yes,returns
+		for (DATA_NODE<TK, TV>*pNext = (DATA_NODE<TK, TV>*)pEntry->p; pNext; pNext = pNext->pNext)
+		{
+			if (h == pNext->h&&Key == pNext->key)
+			{
+				pRet = pNext;
+				return HASH_KEY_EXIST;
+			}
+		}
+        pRet = Pool.LockAlloc();
+        if (!pRet)
+            return ERR_MEMORY;
+        new(pRet) DATA_NODE<TK, TV>(h, std::forward<K>(Key), std::forward<Args>(args)...);	//Initializes the node
+        linkData(pT, pEntry, pRet);
+	}
+    else    //If the bucket contains a B-tree
+	{
+        // Pre-allocation of data nodes
+        // Be careful here. The execution order of LockAlloc() and pEntry->p->Insert(Key, h, tmp) is important.
+        //If the allocation failed after a successful calling of pEntry->p->Insert(),the BTree pointed by p would contain an "incomplete" item
+        //which doesn't have data
+        pRet = Pool.LockAlloc();
+        if (!pRet)
+        {
+            int index;
             zBTreeNode<TK,TV> *pBTNode=pEntry->p->Search(Key,h,index);
             if(pBTNode) //If (key,h) already exists
             {
                 pRet=pBTNode->Key[index];
-                return 1;
+                return HASH_KEY_EXIST;
             }
-			if (pauseAndUpsize())
-            {
-                //The hash is related to the size of the bucket table,so it should be recalculated after successful expantion
-                h = pHashFun(Key, MaskBits);
-                //Be careful,do not forget to unlock the old bucket before changing into the new bucket
-                pEntry->lock.WUnlock();
-                pEntry = pBucket + (h & (size_t)PosMask);
-                pEntry->lock.WLock();	//Locks the new bucket
-				goto INSERT_BEGIN;
-			}
-			else
-				return -1;
+            return ERR_MEMORY;
 		}
         DATA_NODE<TK, TV>**tmp;//To store the data node pointer returned from the B-tree
 
 		int ret = pEntry->p->Insert(Key, h, tmp);
         if (!ret)//If inserting succeeds
 		{
-            new(pRet) DATA_NODE<TK, TV>;	//Initializes the data node
-			pRet->h = h;
-			pRet->key = Key;
+            new(pRet) DATA_NODE<TK, TV>(h, std::forward<K>(Key), std::forward<Args>(args)...);	//Initializes the data node
 			*tmp = pRet;
 		}
         else if (ret == 1)	//If (key,h) already exists
 		{
-            pHeap->LockFree(pRet);//Frees the pre-allocated data node
+            Pool.LockFree(pRet);//Frees the pre-allocated data node
 			pRet = *tmp;
-			return 1;
+			return HASH_KEY_EXIST;
 		}
         else    //If because of insufficient capacity
 		{
-            pHeap->LockFree(pRet);//Frees the pre-allocated data node
-            if (pauseAndUpsize())
-            {
-                //The hash is related to the size of the bucket table,so it should be recalculated after expantion
-                h = pHashFun(Key, MaskBits);
-                //Be careful,do not forget to unlock the old bucket before changing into the new bucket
-                pEntry->lock.WUnlock();
-                pEntry = pBucket + (h&(size_t)PosMask);
-                pEntry->lock.WLock();	//Locks the new bucket
-				goto INSERT_BEGIN;
-			}
-			else
-				return -1;
+            Pool.LockFree(pRet);//Frees the pre-allocated data node
+            return ERR_MEMORY;
 		}
 	}
-	return 0;
+	return SUCCESS;
 }
 
 template<class TK, class TV>
-DATA_NODE<TK, TV>* zHash<TK, TV>::searchAndRLock(TK &key, ENTRY *& pEntry)
+typename zHash<TK, TV>::TABLE* zHash<TK, TV>::lockForInsert(size_t h, ENTRY *&pEntry)
 {
-    size_t h = pHashFun(key, MaskBits);
-    pEntry = pBucket + (h&(size_t)PosMask);
-    if (!pEntry->p)	//If empty,searching fails,returns
-		return 0;
-    pEntry->lock.RLock();	//read locks the entrance
+    do {
+        //Reads pTab before pTabOld. See startResize()
+        TABLE *pT = pTab.load(std::memory_order_acquire);
+        TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+        if (pOld && pOld != pT)
+        {
+            //The current table must keep room for the items of the old table. If the items reach its threshold before all buckets
+            //have been moved,which happens only when the moving threads are delayed,the caller must finish moving by grow() first
+            if (approxCount() >= pT->Threshold)
+            {
+                pEntry = 0;
+                return pT;
+            }
+            //Moves the old bucket first,otherwise the key might be inserted into the new table while it exists in the old one
+            int ret = moveBucket(pOld, pT, h & pOld->PosMask);
+            if (ret == ERR_MEMORY)
+            {
+                pEntry = 0;
+                return pT;
+            }
+            if (ret == 1)
+                finishResize(pOld);
+        }
+        pEntry = pT->pBucket + (h & pT->PosMask);
+        pEntry->WLock();	//locks the bucket entry
+        //If pT has become the old table and the bucket has been moved,tries again in the new table
+        if (!pEntry->Moved)
+            return pT;
+        pEntry->WUnlock();
+    } while (true);
+}
+
+template<class TK, class TV>
+typename zHash<TK, TV>::TABLE* zHash<TK, TV>::locate(size_t h, ENTRY *&pEntry)
+{
+    //Reads pTab before pTabOld. See startResize()
+    TABLE *pT = pTab.load(std::memory_order_acquire);
+    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+    if (pOld && pOld != pT)
+    {
+        pEntry = pOld->pBucket + (h & pOld->PosMask);
+        if (!pEntry->Moved)
+            return pOld;
+    }
+    pEntry = pT->pBucket + (h & pT->PosMask);
+    return pT;
+}
+
+template<class TK, class TV>
+typename zHash<TK, TV>::ENTRY* zHash<TK, TV>::lockBucket(size_t h)
+{
+    ENTRY *pEntry;
+    do {
+        locate(h, pEntry);
+        if (!pEntry->p)
+        {
+            //The bucket may be empty because it has just been moved. See moveBucket()
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (pEntry->Moved)
+                continue;
+            return 0;
+        }
+        pEntry->WLock();
+        if (!pEntry->Moved)
+            return pEntry;
+        //The bucket has been moved into the new table,tries again
+        pEntry->WUnlock();
+    } while (true);
+}
+
+template<class TK, class TV>
+template<class K>
+DATA_NODE<TK, TV>* zHash<TK, TV>::searchAndRLock(const K &key, size_t h, ENTRY *& pEntry)
+{
+    do {
+        locate(h, pEntry);
+        if (!pEntry->p)	//If empty,searching fails,returns
+        {
+            //The bucket may be empty because it has just been moved. See moveBucket()
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!pEntry->Moved)
+                return 0;
+            continue;
+        }
+        pEntry->lock.RLock();	//read locks the entrance
+        if (!pEntry->Moved)
+            break;
+        //The bucket has been moved into the new table,tries again
+        pEntry->lock.RUnlock();
+    } while (true);
 	DATA_NODE<TK, TV>*pRet;
     if (!pEntry->p)	//Because of multithreading,checks again after locking
 	{
@@ -1590,124 +3281,452 @@ DATA_NODE<TK, TV>* zHash<TK, TV>::searchAndRLock(TK &key, ENTRY *& pEntry)
 }
 
 template<class TK, class TV>
-void zHash<TK, TV>::close()
+template<class K>
+int zHash<TK, TV>::searchOptimistic(const K &key, size_t h, DATA_NODE<TK, TV>* &pRet)
 {
-	if (pBucket)
-	{
-        //Scans to delete B-trees
-		for (size_t i = 0; i < Buckets; ++i)
-		{
-			if (pBucket[i].p && pBucket[i].Size_Type <= 0)
-				delete pBucket[i].p;
-		}
-		delete pHeap;
-		pHeap = 0;
-		delete pBTNodeHeap;
-		pBTNodeHeap = 0;
-        free(pBucket);
-		pBucket = 0;
-	}
+    ENTRY *pEntry;
+    for (int i = 0; i < OPTIMISTIC_TRIES; ++i)
+    {
+        locate(h, pEntry);
+        //Reads the version first.If it's odd,a writer is changing the bucket
+        uint32_t Ver = pEntry->Version.load(std::memory_order_acquire);
+        if (Ver & 0x1)
+            continue;
+        DATA_NODE<TK, TV> *pD = (DATA_NODE<TK, TV>*)pEntry->p;
+        size_t Size = pEntry->Size_Type;
+        uint32_t Head = pEntry->Head;
+        bool Moved = pEntry->Moved;
+        //"acquire fence" guarantees that the version is read again after reading the bucket
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pEntry->Version.load(std::memory_order_relaxed) != Ver)
+            continue;
+        //The bucket has been moved into the new table. locate() will find the new bucket
+        if (Moved)
+            continue;
+        if (!pD)
+            return 0;
+        if (Size <= 0)	//The B-tree can't be searched without lock
+            return -1;
+        //The only data node has another hash.It isn't read at all
+        if (Size == 1 && Head != fingerprint(h))
+            return 0;
+        //The linked list may be changed while searching,but all data nodes in it stay valid until the caller leaves the epoch.
+        //The number of steps is limited to Size,otherwise the version must have changed
+        for (; pD && Size; pD = pD->pNext, --Size)
+        {
+            if (h == pD->h && key == pD->key)
+            {
+                pRet = pD;
+                return 1;
+            }
+        }
+        //Not found.It's true only if the bucket hasn't been changed while searching
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pEntry->Version.load(std::memory_order_relaxed) == Ver)
+            return 0;
+    }
+    return -1;
 }
 
-// Summary: Calculates the hash value according to the key value and finds the corresponding bucket entrance.
-//Tries to insert a key value after the bucket entry is write locked. After (Key) is successfully inserted, the data
-//pointed to by pValue is written into. Then the bucket unlocks the bucket and returns
 template<class TK, class TV>
-int zHash<TK, TV>::Insert(TK Key, const TV *pValue)
+template<class K>
+int zHash<TK, TV>::searchCopy(const K &key, size_t h, TV *pRet)
 {
-	begin();
-    size_t h = pHashFun(Key, MaskBits);
-    ENTRY *pT = pBucket + (h&(size_t)PosMask);
-    pT->lock.WLock();	//locks the bucket entry
-	DATA_NODE<TK, TV>* pRet;
-    int ret = insertKey(pT, h, Key, pRet);
-    if (!ret)	//Fills the data node on successful inserting
-	{
-		pRet->value = *pValue;
-		pT->lock.WUnlock();
-		endAdd();
-		return 0;
-	}
-	pT->lock.WUnlock();
-	end();
-	return ret;
+    ENTRY *pEntry;
+    for (int i = 0; i < OPTIMISTIC_TRIES; ++i)
+    {
+        locate(h, pEntry);
+        uint32_t Ver = pEntry->Version.load(std::memory_order_acquire);
+        if (Ver & 0x1)
+            continue;
+        bool Empty = !pEntry->p;
+        size_t Size = pEntry->Size_Type;
+        uint32_t Head = pEntry->Head;
+        bool Moved = pEntry->Moved;
+        HEAD_ITEM Copy = pEntry->Copy;
+        //The copy is valid only if the version hasn't changed while reading it.See searchOptimistic()
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pEntry->Version.load(std::memory_order_relaxed) != Ver)
+            continue;
+        if (Moved)
+            continue;
+        if (Empty)
+            return 0;
+        if (Size <= 0)
+            return -1;
+        if (Head == fingerprint(h) && key == Copy.Key)
+        {
+            //An expired item is absent,though it stays in the bucket until it's reaped
+            if (Copy.Expire && Copy.Expire <= nowMs())
+                return 0;
+            *pRet = Copy.Value;
+            return 1;
+        }
+        return Size == 1 ? 0 : -1;
+    }
+    return -1;
 }
 
-//Summary:Finds the bucket entry based on the hash value of (Key) and write locks it. Tries to insert a key value,
-//if it does not exist and the insertion fails, returns false; If the insertion is successful or the key already exists,
-// Then fills/updates the data
 template<class TK, class TV>
-bool zHash<TK, TV>::Upsert(TK Key, TV *pValue)
+void zHash<TK, TV>::retireData(DATA_NODE<TK, TV> *pData)
 {
-	begin();
-    size_t h = pHashFun(Key, PosMask, MaskBits);
-    ENTRY *pT = pBucket + (h&(size_t)PosMask);
-	DATA_NODE<TK, TV>* pRet;
-    pT->lock.WLock();	//locks the bucket entry
-    int ret = insertKey(pT, h, Key, pRet);
-    if (ret == ERR_MEMORY)	//Full,no space to insert
-	{
-		pT->lock.WUnlock();
-		end();
-		return false;
-	}
+    DATA_NODE<TK, TV> *Buf[RETIRE_BATCH];
+    RetireLock.Lock();
+    Retired[RetiredNum++] = pData;
+    if (RetiredNum < RETIRE_BATCH)
+    {
+        RetireLock.Unlock();
+        return;
+    }
+    //The batch is full.Takes it out and frees it after waiting for the readers,so that the other threads can retire data nodes meanwhile
+    memcpy(Buf, Retired, sizeof(Buf));
+    RetiredNum = 0;
+    RetireLock.Unlock();
+    Epoch.Synchronize();
+    freeData(Buf, RETIRE_BATCH);
+}
 
-    //Updates the data node with new data  if the (key) is inserted or exists before
-	pRet->value = *pValue;
-	pT->lock.WUnlock();
-	if (!ret)	//如果插入了一条记录
-		endAdd();
-	else
-		end();
-	return true;
+template<class TK, class TV>
+bool zHash<TK, TV>::flushRetired()
+{
+    DATA_NODE<TK, TV> *Buf[RETIRE_BATCH];
+    RetireLock.Lock();
+    size_t Num = RetiredNum;
+    memcpy(Buf, Retired, Num * sizeof(Buf[0]));
+    RetiredNum = 0;
+    RetireLock.Unlock();
+    if (!Num)
+        return false;
+    Epoch.Synchronize();
+    freeData(Buf, Num);
+    return true;
 }
 
-//Summary:calls searchAndRLock() to find the data node,then returns the data
 template<class TK, class TV>
-bool zHash<TK, TV>::Value(TK Key, TV *pRet)
+void zHash<TK, TV>::close()
 {
-	ENTRY *pT;
-	begin();
-	DATA_NODE<TK, TV>*pD = searchAndRLock(Key, pT);
-	if (!pD)	//如果没有
+    //Waits for the resizing workers and the reaper to exit
+    ReaperRun = false;
+    while (WorkerNum.load(std::memory_order_acquire))
+        std::this_thread::yield();
+    TABLE *pT = pTabOld.load(std::memory_order_acquire);
+    if (pT)
+    {
+        freeTable(pT);
+        pTabOld.store(0, std::memory_order_relaxed);
+    }
+    pT = pTab.load(std::memory_order_acquire);
+    if (pT)
 	{
-		pT->lock.RUnlock();
-		end();
-		return false;
+        freeTable(pT);
+        pTab.store(0, std::memory_order_relaxed);
 	}
+    //No reader can see the retired data nodes when the hash table is closed
+    for (size_t i = 0; i < RetiredNum; ++i)
+        Retired[i]->~DATA_NODE();
+    RetiredNum = 0;
+    delete[] pWheel.load(std::memory_order_relaxed);
+    pWheel.store(0, std::memory_order_relaxed);
+    delete[] pSessions.load(std::memory_order_relaxed);
+    pSessions.store(0, std::memory_order_relaxed);
+}
+
+template<class TK, class TV>
+typename zHash<TK, TV>::SESSION_SLOT *zHash<TK, TV>::openSession()
+{
+    SESSION_SLOT *pRet = 0;
+    SessionLock.Lock();
+    SESSION_SLOT *pS = pSessions.load(std::memory_order_relaxed);
+    if (!pS)
+    {
+        pS = new(nothrow) SESSION_SLOT[MAX_SESSIONS];
+        if (pS)
+        {
+            for (int i = 0; i < MAX_SESSIONS; ++i)
+            {
+                atomic_init(&pS[i].Active, 0);
+                pS[i].Used = false;
+            }
+            pSessions.store(pS, std::memory_order_release);
+        }
+    }
+    for (uint32_t i = 0; pS && i < MAX_SESSIONS; ++i)
+    {
+        if (pS[i].Used)
+            continue;
+        pS[i].Used = true;
+        if (i >= SessionTop.load(std::memory_order_relaxed))
+            SessionTop.store(i + 1, std::memory_order_seq_cst);
+        pRet = pS + i;
+        break;
+    }
+    SessionLock.Unlock();
+    return pRet;
+}
+
+// Summary: Calculates the hash value according to the key value and finds the corresponding bucket entrance.
+//Tries to insert a key value after the bucket entry is write locked. After (Key) is successfully inserted, the data
+//pointed to by pValue is written into. Then the bucket unlocks the bucket and returns
+//If there's no space,unlocks the bucket and tries to get more space by grow(),then inserts again
+//If (Overwrite) is true and the key already exists,updates the data
+//(Key) and (args) are forwarded only once,because insertKey() doesn't use them if it fails.
+//The expired items of a linked list are reclaimed first,since the bucket is write locked anyway. A B-tree is left to ReapExpired(),
+//but an expired item found by insertKey() is replaced like a new one
+template<class TK, class TV>
+template<class K, class... Args>
+int zHash<TK, TV>::insertEx(K &&Key, size_t h, bool Overwrite, uint64_t Expire, Args&&... args)
+{
+    do {
+        ENTRY *pT;
+        DATA_NODE<TK, TV>* pRet;
+        TABLE *pTable = lockForInsert(h, pT);
+        if (pT)
+        {
+            DATA_NODE<TK, TV> *Victims[MAX_LINKEDLIST_SIZE];
+            size_t Reaped = 0;
+            if (HasTTL && pT->Size_Type > 0)
+                Reaped = unlinkIf(pT, MAX_LINKEDLIST_SIZE, [](DATA_NODE<TK, TV> *pD) { return expired(pD); }, Victims);
+            int ret = insertKey(pTable, pT, h, std::forward<K>(Key), pRet, std::forward<Args>(args)...);
+            //The existing item is locked by LockItem().Waits with the bucket unlocked,so the other items of the bucket stay available
+            if (ret == HASH_KEY_EXIST && pRet->Pinned && (Overwrite || expired(pRet)))
+            {
+                pT->WUnlock();
+                freeVictims(Victims, Reaped);
+                waitPinned();
+                continue;
+            }
+            bool Added = ret == SUCCESS;
+            if (Added && Expire != EXPIRE_KEEP)
+                pRet->Expire.store(Expire, std::memory_order_relaxed);
+            //Updates the data node with new data if the (key) exists before
+            //Other threads may be reading the existing data node,so the sequence lock is needed
+            else if (ret == HASH_KEY_EXIST && (Overwrite || expired(pRet)))
+            {
+                pRet->slock.WLock();
+                if (expired(pRet))
+                {
+                    replaceValue(pRet->value, std::forward<Args>(args)...);
+                    pRet->Expire.store(Expire == EXPIRE_KEEP ? 0 : Expire, std::memory_order_relaxed);
+                    ret = SUCCESS;
+                }
+                else
+                {
+                    assignValue(pRet->value, std::forward<Args>(args)...);
+                    if (Expire != EXPIRE_KEEP)
+                        pRet->Expire.store(Expire, std::memory_order_relaxed);
+                }
+                pRet->slock.WUnlock();
+            }
+            pT->WUnlock();
+            freeVictims(Victims, Reaped);
+            if (ret != ERR_MEMORY)
+            {
+                if (Added)
+                {
+                    added();
+                    size_t Count = approxCount();
+                    if (CacheSize && Count > CacheSize)
+                        evict(Count - CacheSize);
+                }
+                return ret;
+            }
+        }
+        //A cache makes room by evicting when it can't grow
+        if (!grow(pTable) && !(CacheSize && evict(1)))
+            return ERR_MEMORY;
+        //Restarts visiting before trying again,so that a thread waiting for the visitors to pause can go on
+        end();
+        begin();
+        helpResize(MOVE_STEP);
+    } while (true);
+}
+
+template<class TK, class TV>
+int zHash<TK, TV>::Insert(const TK &Key, const TV *pValue)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    int ret = insert(Key, hashKey(Key), false, *pValue);
+	end();
+	return ret;
+}
+
+template<class TK, class TV>
+int zHash<TK, TV>::Insert(TK &&Key, TV &&Value)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    size_t h = hashKey(Key);
+    int ret = insert(std::move(Key), h, false, std::move(Value));
+	end();
+	return ret;
+}
+
+template<class TK, class TV>
+template<class K, class... Args>
+int zHash<TK, TV>::Emplace(K &&Key, Args&&... args)
+{
+    int ret;
+	begin();
+    helpResize(MOVE_STEP);
+    if constexpr (IS_VIEW<K>)	//Hashes and compares the view.TK is constructed from the view in the data node
+    {
+        KEY_VIEW View(Key);
+        ret = insert(View, hashKey(View), false, std::forward<Args>(args)...);
+    }
+    else if constexpr (std::is_same_v<std::decay_t<K>, TK>)
+    {
+        size_t h = hashKey(Key);
+        ret = insert(std::forward<K>(Key), h, false, std::forward<Args>(args)...);
+    }
+    else
+    {
+        TK NewKey(std::forward<K>(Key));
+        size_t h = hashKey(NewKey);
+        ret = insert(std::move(NewKey), h, false, std::forward<Args>(args)...);
+    }
+	end();
+	return ret;
+}
+
+//Summary:Finds the bucket entry based on the hash value of (Key) and write locks it. Tries to insert a key value,
+//if it does not exist and the insertion fails, returns false; If the insertion is successful or the key already exists,
+// Then fills/updates the data
+template<class TK, class TV>
+bool zHash<TK, TV>::Upsert(const TK &Key, const TV *pValue)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    int ret = insert(Key, hashKey(Key), true, *pValue);
+	end();
+	return ret != ERR_MEMORY;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::Upsert(TK &&Key, TV &&Value)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    size_t h = hashKey(Key);
+    int ret = insert(std::move(Key), h, true, std::move(Value));
+	end();
+	return ret != ERR_MEMORY;
+}
+
+//Summary:calls searchOptimistic() to find the data node without locking,then reads the data with the sequence lock.
+//If the bucket can't be read without lock,calls searchAndRLock() to find the data node and reads the data with the bucket read locked
+template<class TK, class TV>
+template<class K>
+bool zHash<TK, TV>::value(const K &Key, size_t h, TV *pRet)
+{
+    DATA_NODE<TK, TV>*pD;
+    int ret;
+    //A hit on the first item of the bucket reads the bucket entry only.In cache mode the data node is read anyway to mark it(see touch())
+    if constexpr (INLINE_HEAD)
+    {
+        if (!CacheSize && (ret = searchCopy(Key, h, pRet)) >= 0)
+            return ret;
+    }
+    int Tries = OPTIMISTIC_TRIES;
+    uint32_t Token = Epoch.Enter();
+    do {
+        ret = searchOptimistic(Key, h, pD);
+        if (ret != 1)
+            break;
+        //The data node may be removed at any time.The value is valid only if the data node is still in the bucket
+        bool Removed;
+        int Ver;
+        do {
+            Ver = pD->slock.ReadBegin();
+            *pRet = pD->value;
+            Removed = pD->Removed;
+        } while (pD->slock.ReadRetry(Ver));
+        if (!Removed)
+        {
+            //An expired item is absent,though it stays in the bucket until it's reaped
+            if (expired(pD))
+                ret = 0;
+            else
+                touch(pD);
+            break;
+        }
+        ret = -1;
+    } while (--Tries);
+    Epoch.Leave(Token);
+    if (ret >= 0)
+        return ret;
+
+    ENTRY *pT;
+	pD = searchAndRLock(Key, h, pT);
+    if (!pD)	//如果没有。The bucket isn't locked
+		return false;
 
     // When the entry of the bucket is read locked, the data node cannot be deleted, but may be modified.
     // To ensure the consistency of read data, use sequence lock to control reading and writing data
+    if (expired(pD))
+    {
+        pT->lock.RUnlock();
+        return false;
+    }
 	int Ver;
 	do {
 		Ver = pD->slock.ReadBegin();
 		*pRet = pD->value;
 	} while (pD->slock.ReadRetry(Ver));
+    touch(pD);
 	pT->lock.RUnlock();
-	end();
 	return true;
 }
 
+template<class TK, class TV>
+bool zHash<TK, TV>::Value(const TK &Key, TV *pRet)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    bool ret = value(Key, hashKey(Key), pRet);
+    end();
+    countLookups(ret, !ret);
+    return ret;
+}
+
 //Summary:Finds the corresponding bucket based on the hash value calculated by the key value. If there is no data
 //in the bucket, return; Otherwise, the bucket entry is write locked. After the locking, searches for and deletes
 //data according to data structures attached to the bucket
 template<class TK, class TV>
-bool zHash<TK, TV>::Del(TK Key, TV *pRet)
+template<class K>
+bool zHash<TK, TV>::del(const K &Key, size_t h, TV *pRet)
 {
-    size_t h = pHashFun(Key, PosMask, MaskBits);
-	begin();
-    ENTRY *pEntry = pBucket + (h&(size_t)PosMask);
-    if (!pEntry->p)	//(key) doesn't exist
-	{
-		end();
-		return false;
-	}
-    pEntry->lock.WLock();	//locks the entry
+    ENTRY *pEntry;
+    DATA_NODE<TK, TV> *pD;
+    DATA_NODE<TK, TV> *Victims[MAX_LINKEDLIST_SIZE];
+    size_t Reaped;
+    bool Expired;
+RETRY:
+    Reaped = 0;
+    do {
+        locate(h, pEntry);
+        if (!pEntry->p)	//(key) doesn't exist
+        {
+            //The bucket may be empty because it has just been moved. See moveBucket()
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (pEntry->Moved)
+                continue;
+            return false;
+        }
+        pEntry->WLock();	//locks the entry
+        if (!pEntry->Moved)
+            break;
+        //The bucket has been moved into the new table,tries again
+        pEntry->WUnlock();
+    } while (true);
+    //The expired items of a linked list are reclaimed,since the bucket is write locked anyway
+    if (HasTTL && pEntry->p && pEntry->Size_Type > 0)
+        Reaped = unlinkIf(pEntry, MAX_LINKEDLIST_SIZE, [](DATA_NODE<TK, TV> *pD) { return expired(pD); }, Victims);
     if (!pEntry->p)	//Checks the entry again after locking bcause of muti-threads
 		goto EXIT_NONE;
     if (pEntry->Size_Type > 0)	//If linked list
 	{
-		DATA_NODE<TK, TV> *pD = (DATA_NODE<TK, TV>*)pEntry->p;
+		pD = (DATA_NODE<TK, TV>*)pEntry->p;
         DATA_NODE<TK, TV> * pPre = 0;//The previos node of pD
 		while (pD)
 		{
@@ -1719,198 +3738,2326 @@ bool zHash<TK, TV>::Del(TK Key, TV *pRet)
 		}
         if (!pD)	//Already reaches the end of the linked list if pD=0
 			goto EXIT_NONE;
+        if (pD->Pinned)
+            goto WAIT_PINNED;
+        //pD->pNext is kept,so that the readers without lock which are reading pD can go on
         if (!pPre)	//If it's the first data node
+        {
 			pEntry->p = (zBTree<TK, TV> *)pD->pNext;
+            if (pD->pNext)
+                pEntry->Head = fingerprint(pD->pNext->h);
+        }
         else    //If it's not the first data node
 			pPre->pNext = pD->pNext;
 
-        if (pRet)	//If the caller needs the the deleted data value
-			*pRet = pD->value;
-        pHeap->LockFree(pD);//Frees the data node
         if (!(--pEntry->Size_Type))	//If the amount decreases to zero,marks the bucket as empty
 			pEntry->p = 0;
 	}
     else    //If B-tree
 	{
-		DATA_NODE<TK, TV> *pD = pEntry->p->Remove(Key, h);
+        pD = pEntry->p->FindData(Key, h);
         if (!pD)//(Key,h) doesn't exist in the tree
 			goto EXIT_NONE;
-        if (pRet)	//If the caller needs the the deleted data value
-			*pRet = pD->value;
-        //Frees the data node
-		pHeap->LockFree(pD);
+        if (pD->Pinned)
+            goto WAIT_PINNED;
+        pEntry->p->Remove(Key, h);
         //如If the amount is less than MIN_BTREE_SIZE,convert B-tree into linked list
 		if (pEntry->p->Count() < MIN_BTREE_SIZE)
             treeToList(pEntry);
 	}
-	pEntry->lock.WUnlock();
-	endDel();
-	return true;
+    //Marks the data node as removed,so that the threads which have found it without lock know it's no longer valid.
+    //An expired item of a B-tree is removed as well,but it's absent to the caller
+    pD->slock.WLock();
+    Expired = expired(pD);
+    if constexpr (std::is_copy_assignable_v<TV>)
+    {
+        if (pRet && !Expired)	//If the caller needs the the deleted data value
+            *pRet = pD->value;
+    }
+    pD->Removed = true;
+    pD->slock.WUnlock();
+	pEntry->WUnlock();
+    freeVictims(Victims, Reaped);
+    //The readers without lock may be reading the data node,so it's retired rather than freed
+    retireData(pD);
+	removed();
+	return !Expired;
 
 EXIT_NONE:	//Doesn't find the key,unlocks and returns
-	pEntry->lock.WUnlock();
-	end();
+	pEntry->WUnlock();
+    freeVictims(Victims, Reaped);
 	return false;
+
+WAIT_PINNED:	//The item is locked by LockItem().Waits with the bucket unlocked and tries again
+    pEntry->WUnlock();
+    freeVictims(Victims, Reaped);
+    waitPinned();
+    goto RETRY;
 }
 
+template<class TK, class TV>
+bool zHash<TK, TV>::Del(const TK &Key, TV *pRet)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    bool ret = del(Key, hashKey(Key), pRet);
+    end();
+    return ret;
+}
 
 template<class TK, class TV>
-void zHash<TK, TV>::CheckHash(size_t &Buckets,size_t &FilledBuckets,size_t &Elements,size_t &Collisions, size_t &MaxCollision)
+size_t zHash<TK, TV>::evict(size_t Num)
 {
-    Buckets=this->Buckets;
-	if (Resizable)
+    //The current table can't be freed before end(),though a resizing may start meanwhile and make it the old table
+    TABLE *pT = pTab.load(std::memory_order_acquire);
+    size_t Count = 0;
+    for (int i = 0; i < EVICT_SCAN && Count < Num; ++i)
     {
-        //If the hash table is resizable,pauses resizing function
-		ResizeLock.Lock();
-        FlagResize = true;
-        //全内存屏障，保证下面等待过程的执行发生在FlagResize设置之后
-        //和begin()内对应形成互锁
-        //Release memory fence guarantees that "FlagResize = true" is executed before the first writes of the subsequent codes(C++ order)
-        //That is,it's guaranteed that FlagResize is set to true before the thread really begins to wait for other threads to suspend
-        std::atomic_thread_fence(std::memory_order_release);
-		waitVisitorsPause();
-	}
-
-    //Checks and collects the situation of distribution and collisions
-    FilledBuckets=0;
-    Elements=0;
-    Collisions = 0;
-    MaxCollision=0;
+        size_t Pos = std::atomic_fetch_add_explicit(&ClockHand, 1, std::memory_order_relaxed) & pT->PosMask;
+        Count += evictBucket(pT->pBucket + Pos, Num - Count);
+    }
+    if (Count)
+        std::atomic_fetch_add_explicit(&StatSlots[zThreadIndex() & (STAT_SLOTS - 1)].Evictions, Count, std::memory_order_relaxed);
+    return Count;
+}
 
-    for (unsigned int i = 0; i < Buckets; ++i)
-		if (pBucket[i].p)
-		{
-            ++FilledBuckets;
-            if(pBucket[i].Size_Type==1)
+//Summary:walks the data nodes of the bucket like moveBucket() does.A victim is unlinked like del() does it
+template<class TK, class TV>
+template<class F>
+size_t zHash<TK, TV>::unlinkIf(ENTRY *pEntry, size_t Num, F &&IsVictim, DATA_NODE<TK, TV> **Victims)
+{
+    size_t Count = 0;
+    if (Num > MAX_LINKEDLIST_SIZE)
+        Num = MAX_LINKEDLIST_SIZE;
+    if (!pEntry->p)
+        return 0;
+    if (pEntry->Size_Type > 0)	//If linked list
+    {
+        DATA_NODE<TK, TV> *pPre = 0;
+        for (DATA_NODE<TK, TV> *pD = (DATA_NODE<TK, TV>*)pEntry->p; pD; pD = pD->pNext)
+        {
+            if (Count == Num || pD->Pinned || !IsVictim(pD))
             {
-                ++Elements;
+                pPre = pD;
+                continue;
             }
-            else if (pBucket[i].Size_Type >= 2) //Linked list
+            //pD->pNext is kept,so that the readers without lock which are reading pD can go on
+            if (!pPre)
+                pEntry->p = (zBTree<TK, TV> *)pD->pNext;
+            else
+                pPre->pNext = pD->pNext;
+            --pEntry->Size_Type;
+            Victims[Count++] = pD;
+        }
+        if (!pEntry->Size_Type)
+            pEntry->p = 0;
+        else
+            pEntry->Head = fingerprint(((DATA_NODE<TK, TV>*)pEntry->p)->h);
+    }
+    else    //If B-tree
+    {
+        size_t Size = pEntry->p->Count();
+        DATA_NODE<TK, TV> **pBuf = new(nothrow) DATA_NODE<TK, TV>*[Size];
+        if (!pBuf)
+            return 0;
+        pEntry->p->FindAllData(pBuf);
+        size_t Spare = Size >= MIN_BTREE_SIZE ? Size - MIN_BTREE_SIZE + 1 : 0;
+        if (Num > Spare)
+            Num = Spare;
+        for (size_t i = 0; i < Size && Count < Num; ++i)
+        {
+            if (!pBuf[i]->Pinned && IsVictim(pBuf[i]))
             {
-                Elements+=pBucket[i].Size_Type;
-                ++Collisions;
-                if(MaxCollision<pBucket[i].Size_Type)
-                    MaxCollision=pBucket[i].Size_Type;
-			}
-            else if (!pBucket[i].Size_Type) //B-tree
-			{
-                size_t temp=pBucket[i].p->Count();
-                Elements+=temp;
-                ++Collisions;
-                if(MaxCollision<temp)
-                    MaxCollision=temp;
-			}
-		}
-	if (Resizable)
-	{
-        //Release memory fence guarantees that "FlagResize = false" is executed after all previous codes (C++ order)
-        std::atomic_thread_fence(std::memory_order_release);
-		FlagResize = false;
-		ResizeLock.Unlock();
-	}
+                pEntry->p->Remove(pBuf[i]->key, pBuf[i]->h);
+                Victims[Count++] = pBuf[i];
+            }
+        }
+        delete[] pBuf;
+        if (pEntry->p->Count() < MIN_BTREE_SIZE)
+            treeToList(pEntry);
+    }
+    //Marks the data nodes as removed,so that the threads which have found them without lock know they're no longer valid
+    for (size_t i = 0; i < Count; ++i)
+    {
+        Victims[i]->slock.WLock();
+        Victims[i]->Removed = true;
+        Victims[i]->slock.WUnlock();
+    }
+    return Count;
 }
 
+//Summary:an expired item is evicted first.A marked item gets a second chance by being unmarked
 template<class TK, class TV>
-bool zHash<TK, TV>::TestHash(ZHASH_FUNCTION pFun,TK Key[],size_t KeyNum,size_t Buckets,size_t &FilledBuckets,size_t &Collitions,size_t &MaxCollition)
+size_t zHash<TK, TV>::evictBucket(ENTRY *pEntry, size_t Num)
 {
-    FilledBuckets=0;
-    Collitions=0;
-    MaxCollition=0;
-    size_t *pB=(size_t*)malloc(KeyNum*sizeof(size_t));
-    if(!pB)
+    if (!pEntry->p)
+        return 0;
+    pEntry->WLock();
+    if (pEntry->Moved)
+    {
+        pEntry->WUnlock();
+        return 0;
+    }
+    DATA_NODE<TK, TV> *Victims[MAX_LINKEDLIST_SIZE];
+    size_t Count = unlinkIf(pEntry, Num, [](DATA_NODE<TK, TV> *pD) {
+        if (expired(pD) || !pD->Referenced)
+            return true;
+        pD->Referenced = false;
         return false;
-    memset(pB,0,KeyNum*sizeof(size_t));
-    for(size_t i=0;i<KeyNum;++i)
-        ++pB[pFun(Key[i])%Buckets];
-    for(size_t i=0;i<Buckets;++i)
+    }, Victims);
+    pEntry->WUnlock();
+    freeVictims(Victims, Count);
+    return Count;
+}
+
+//Summary:locks the bucket the same way del() does.A B-tree may have more expired items than unlinkIf() takes at a time,
+//so the bucket is reaped again until nothing more is found
+template<class TK, class TV>
+size_t zHash<TK, TV>::reapBucket(size_t h)
+{
+    size_t Total = 0;
+    size_t Count;
+    do {
+        ENTRY *pEntry;
+        do {
+            locate(h, pEntry);
+            if (!pEntry->p)
+            {
+                //The bucket may be empty because it has just been moved. See moveBucket()
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (pEntry->Moved)
+                    continue;
+                return Total;
+            }
+            pEntry->WLock();
+            if (!pEntry->Moved)
+                break;
+            pEntry->WUnlock();
+        } while (true);
+        DATA_NODE<TK, TV> *Victims[MAX_LINKEDLIST_SIZE];
+        Count = unlinkIf(pEntry, MAX_LINKEDLIST_SIZE, [](DATA_NODE<TK, TV> *pD) { return expired(pD); }, Victims);
+        pEntry->WUnlock();
+        freeVictims(Victims, Count);
+        Total += Count;
+    } while (Count == MAX_LINKEDLIST_SIZE);
+    return Total;
+}
+
+template<class TK, class TV>
+void zHash<TK, TV>::scheduleExpire(size_t h, uint64_t Expire)
+{
+    WHEEL_SLOT *pW = pWheel.load(std::memory_order_acquire);
+    if (!pW)
     {
-        if(pB[i])
+        //Without the wheel,the item is still absent after it expires,and reclaimed when its bucket is written
+        WHEEL_SLOT *pNew = new(nothrow) WHEEL_SLOT[TTL_SLOTS];
+        if (!pNew)
+            return;
+        ReapLock.Lock();
+        pW = pWheel.load(std::memory_order_relaxed);
+        if (!pW)
         {
-            ++FilledBuckets;
-            if(pB[i]>=2)
+            //The ticks before the wheel exists have nothing to reap
+            ReapedTick.store(nowMs() / TTL_TICK, std::memory_order_relaxed);
+            pWheel.store(pNew, std::memory_order_release);
+            pW = pNew;
+            pNew = 0;
+        }
+        ReapLock.Unlock();
+        delete[] pNew;
+    }
+    //The item has expired at the end of its tick.A tick which has been reaped,or is being reaped,is put off to the next tick.
+    //If ReapExpired() has passed the slot meanwhile,the entry is reaped when the wheel comes round again
+    uint64_t Tick = (Expire + TTL_TICK - 1) / TTL_TICK;
+    uint64_t Reaped = ReapedTick.load(std::memory_order_relaxed);
+    if (Tick <= Reaped + 1)
+        Tick = Reaped + 2;
+    WHEEL_SLOT &Slot = pW[Tick & (TTL_SLOTS - 1)];
+    Slot.lock.Lock();
+    Slot.Items.emplace_back(h, Tick);
+    Slot.lock.Unlock();
+}
+
+template<class TK, class TV>
+size_t zHash<TK, TV>::ReapExpired()
+{
+    WHEEL_SLOT *pW = pWheel.load(std::memory_order_acquire);
+    if (!pW || !ReapLock.TryLock())
+        return 0;
+    uint64_t Now = nowMs() / TTL_TICK;
+    uint64_t Tick = ReapedTick.load(std::memory_order_relaxed) + 1;
+    //After a long pause,each slot is reaped once
+    if (Now >= Tick + TTL_SLOTS)
+        Tick = Now - TTL_SLOTS + 1;
+    size_t Count = 0;
+    std::vector<std::pair<size_t, uint64_t>> Due, Later;
+    for (; Tick <= Now; ++Tick)
+    {
+        WHEEL_SLOT &Slot = pW[Tick & (TTL_SLOTS - 1)];
+        Slot.lock.Lock();
+        Due.swap(Slot.Items);
+        Slot.lock.Unlock();
+        //The slot also holds the items of the later rounds of the wheel.They stay in it
+        begin();
+        for (size_t i = 0; i < Due.size(); ++i)
+        {
+            if (Due[i].second > Now)
+                Later.push_back(Due[i]);
+            else
+                Count += reapBucket(Due[i].first);
+            //Restarts visiting now and then,so that a thread waiting for the visitors to pause can go on
+            if (i % SCAN_CHUNK == SCAN_CHUNK - 1)
             {
-                ++Collitions;
-                if(MaxCollition<pB[i])
-                    MaxCollition=pB[i];
+                end();
+                begin();
             }
         }
+        end();
+        Due.clear();
+        if (!Later.empty())
+        {
+            Slot.lock.Lock();
+            Slot.Items.insert(Slot.Items.end(), Later.begin(), Later.end());
+            Slot.lock.Unlock();
+            Later.clear();
+        }
+    }
+    ReapedTick.store(Now, std::memory_order_relaxed);
+    ReapLock.Unlock();
+    return Count;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::StartReaper()
+{
+    if (ReaperRun)
+        return true;
+    ReaperRun = true;
+    //close() waits for the reaper as it does for the resizing workers
+    std::atomic_fetch_add_explicit(&WorkerNum, 1, std::memory_order_relaxed);
+    try {
+        std::thread(&zHash<TK, TV>::reaper, this).detach();
+    }
+    catch (...)
+    {
+        std::atomic_fetch_sub_explicit(&WorkerNum, 1, std::memory_order_relaxed);
+        ReaperRun = false;
+        return false;
     }
-    delete pB;
     return true;
 }
 
-//代码思路:根据键值计算所得哈希值找到对应桶，同时读锁定。若再桶中找到对应记录，那么写锁定记录，更新数据，更新完成解锁返回
-//Summary:According to the calculated hash value of (Key), finds the corresponding bucket and read locked it
-//at the same time. If the item associated with (Key) is found in the bucket, locks the data node and updates the data
 template<class TK, class TV>
-bool zHash<TK, TV>::Update(TK Key, TV *pValue)
+void zHash<TK, TV>::reaper()
 {
-	ENTRY *pT;
-	begin();
-	DATA_NODE<TK, TV>*pD = searchAndRLock(Key, pT);
-    if (!pD)	//Key is not found
-	{
-		pT->lock.RUnlock();
-		end();
-		return false;
-	}
+    while (ReaperRun)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(TTL_TICK));
+        if (ReaperRun)
+            ReapExpired();
+    }
+    //It's the last access to the hash table.close() waits for it
+    std::atomic_fetch_sub_explicit(&WorkerNum, 1, std::memory_order_release);
+}
 
-    //Locks the data node and updates the data
-	pD->slock.WLock();
-	pD->value = *pValue;
-    pD->slock.WUnlock();
+template<class TK, class TV>
+int zHash<TK, TV>::insertWithTTL(const TK &Key, size_t h, const TV &Value, uint64_t TTL, bool Overwrite)
+{
+    HasTTL = true;
+    uint64_t Expire = nowMs() + TTL;
+    int ret = insertEx(Key, h, Overwrite, Expire, Value);
+    if (ret == SUCCESS || (ret == HASH_KEY_EXIST && Overwrite))
+        scheduleExpire(h, Expire);
+    return ret;
+}
 
-    // The read lock of the bucket entry can be unlocked only after the updating is complete; otherwise, it may be deleted by other threads
-    // The deleted data node may have incorrect data if it is immediately reallocated
-    pT->lock.RUnlock();
+template<class TK, class TV>
+int zHash<TK, TV>::InsertWithTTL(const TK &Key, const TV &Value, uint64_t TTL)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    int ret = insertWithTTL(Key, hashKey(Key), Value, TTL, false);
 	end();
-	return true;
+	return ret;
 }
 
 template<class TK, class TV>
-bool zHash<TK, TV>::SetInitBuckets( size_t InitBuckets)
+bool zHash<TK, TV>::UpsertWithTTL(const TK &Key, const TV &Value, uint64_t TTL)
 {
-    zMemHeap<DATA_NODE<TK, TV>> *pNewHeap=0;
-    zMemHeap<zBTreeNode<TK, TV>> * pNewBTNodeHeap=0;
-    ENTRY *pNewBucket=0;
+	begin();
+    helpResize(MOVE_STEP);
+    int ret = insertWithTTL(Key, hashKey(Key), Value, TTL, true);
+	end();
+    return ret != ERR_MEMORY;
+}
 
-    size_t NewBuckets=roundUp(InitBuckets);
-    size_t NewThreshHold=(size_t)((double)NewBuckets*LoadFactor);
+template<class TK, class TV>
+size_t zHash<TK, TV>::ValueBatch(const TK *Keys, size_t Num, TV *pValues, bool *pFound)
+{
+    size_t h[BATCH_STEP];
+    size_t Count = 0;
+	begin();
+    helpResize(MOVE_STEP);
+    for (size_t i = 0; i < Num; i += BATCH_STEP)
+    {
+        size_t n = Num - i < BATCH_STEP ? Num - i : BATCH_STEP;
+        prefetchBatch(Keys + i, n, h);
+        for (size_t k = 0; k < n; ++k)
+        {
+            bool ret = value(Keys[i + k], h[k], pValues + i + k);
+            if (pFound)
+                pFound[i + k] = ret;
+            Count += ret;
+        }
+    }
+    end();
+    countLookups(Count, Num - Count);
+    return Count;
+}
 
-	try {
-		pNewHeap = new zMemHeap<DATA_NODE<TK, TV>>(NewThreshHold);
-		
-		pNewBTNodeHeap = new zMemHeap<zBTreeNode<TK, TV>>((NewThreshHold + KEY_MIN - 1) / KEY_MIN);
-		
-		size_t NewSizeCount = NewBuckets * sizeof(ENTRY);
-		pNewBucket = (ENTRY*)malloc(NewSizeCount);
-		if (!pNewBucket)
-			throw std::bad_alloc();
-	}
-	catch (std::bad_alloc)
-	{
-		if (pNewBTNodeHeap)
-			delete pNewBTNodeHeap;
-		if (pNewBucket)
-			delete pNewBucket;
-		if (pNewBucket)
-			delete pNewBucket;
-		return false;
+template<class TK, class TV>
+size_t zHash<TK, TV>::InsertBatch(const TK *Keys, const TV *pValues, size_t Num, int *pRet)
+{
+    size_t h[BATCH_STEP];
+    size_t Count = 0;
+	begin();
+    helpResize(MOVE_STEP);
+    for (size_t i = 0; i < Num; i += BATCH_STEP)
+    {
+        size_t n = Num - i < BATCH_STEP ? Num - i : BATCH_STEP;
+        prefetchBatch(Keys + i, n, h);
+        for (size_t k = 0; k < n; ++k)
+        {
+            int ret = insert(Keys[i + k], h[k], false, pValues[i + k]);
+            if (pRet)
+                pRet[i + k] = ret;
+            Count += (ret == SUCCESS);
+        }
+        //Inserting may start resizing.Helps it as much as the same number of single insertions would do
+        helpResize(MOVE_STEP);
     }
+    end();
+    return Count;
+}
 
-    //Frees the old resources and setups new resources
-	delete pHeap;
-	delete pBTNodeHeap;
-    free(pBucket);
-    pHeap=pNewHeap;
-    pBTNodeHeap=pNewBTNodeHeap;
-    pBucket=pNewBucket;
-
-    Buckets=NewBuckets;
-    Threshold=NewThreshHold;
-    PosMask = Buckets - 1;
-	MaskBits = zBitCount(PosMask);
+template<class TK, class TV>
+size_t zHash<TK, TV>::DelBatch(const TK *Keys, size_t Num, bool *pDeleted)
+{
+    size_t h[BATCH_STEP];
+    size_t Count = 0;
+	begin();
+    helpResize(MOVE_STEP);
+    for (size_t i = 0; i < Num; i += BATCH_STEP)
+    {
+        size_t n = Num - i < BATCH_STEP ? Num - i : BATCH_STEP;
+        prefetchBatch(Keys + i, n, h);
+        for (size_t k = 0; k < n; ++k)
+        {
+            bool ret = del(Keys[i + k], h[k], 0);
+            if (pDeleted)
+                pDeleted[i + k] = ret;
+            Count += ret;
+        }
+    }
+    end();
+    return Count;
+}
+
+template<class TK, class TV>
+void zHash<TK, TV>::prefetchBatch(const TK *Keys, size_t Num, size_t *h)
+{
+    //Prefetches from the table where the keys are most likely to be.While resizing,it's the old table until the bucket is moved
+    TABLE *pT = pTab.load(std::memory_order_acquire);
+    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+    if (pOld && pOld != pT)
+        pT = pOld;
+    //Stage 1:hashes all keys and prefetches their bucket entries
+    for (size_t k = 0; k < Num; ++k)
+    {
+        h[k] = hashKey(Keys[k]);
+        zPrefetch(pT->pBucket + (h[k] & pT->PosMask));
+    }
+    //Stage 2:prefetches the first data node(or the B-tree) of each bucket.The bucket entries have arrived meanwhile.
+    //A data node which is the only one in its bucket and has another hash won't be read,so it isn't prefetched.
+    //The bucket is read without lock,it's just a hint
+    for (size_t k = 0; k < Num; ++k)
+    {
+        ENTRY *pEntry = pT->pBucket + (h[k] & pT->PosMask);
+        void *p = pEntry->p;
+        if (p && (pEntry->Size_Type != 1 || pEntry->Head == fingerprint(h[k])))
+            zPrefetch(p);
+    }
+}
+
+
+template<class TK, class TV>
+void zHash<TK, TV>::CheckHash(size_t &Buckets,size_t &FilledBuckets,size_t &Elements,size_t &Collisions, size_t &MaxCollision)
+{
+	if (Resizable)
+    {
+        //If the hash table is resizable,pauses resizing function
+		ResizeLock.Lock();
+        FlagResize = true;
+        //Full memory fence.It pairs with the fetch_add in begin(),so either the visitor sees FlagResize or this thread sees the visitor
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+		waitVisitorsPause();
+	}
+
+    //Checks and collects the situation of distribution and collisions
+    FilledBuckets=0;
+    Elements=0;
+    Collisions = 0;
+    MaxCollision=0;
+    Buckets=pTab.load(std::memory_order_acquire)->Buckets;
+
+    //Counts the current table and the old table if it's resizing.The moved buckets of the old table still keep the pointers to
+    //the relinked data nodes until the old table is freed,so they are skipped
+    TABLE *pTables[2] = {pTab.load(std::memory_order_acquire), pTabOld.load(std::memory_order_acquire)};
+    for (TABLE *pT : pTables)
+    {
+        if (!pT)
+            continue;
+        ENTRY *pBucket = pT->pBucket;
+        for (size_t i = 0; i < pT->Buckets; ++i)
+            if (pBucket[i].p && !pBucket[i].Moved)
+            {
+                ++FilledBuckets;
+                if(pBucket[i].Size_Type==1)
+                {
+                    ++Elements;
+                }
+                else if (pBucket[i].Size_Type >= 2) //Linked list
+                {
+                    Elements+=pBucket[i].Size_Type;
+                    ++Collisions;
+                    if(MaxCollision<pBucket[i].Size_Type)
+                        MaxCollision=pBucket[i].Size_Type;
+                }
+                else if (!pBucket[i].Size_Type) //B-tree
+                {
+                    size_t temp=pBucket[i].p->Count();
+                    Elements+=temp;
+                    ++Collisions;
+                    if(MaxCollision<temp)
+                        MaxCollision=temp;
+                }
+            }
+    }
+	if (Resizable)
+	{
+        //Release memory fence guarantees that "FlagResize = false" is executed after all previous codes (C++ order)
+        std::atomic_thread_fence(std::memory_order_release);
+		FlagResize = false;
+		ResizeLock.Unlock();
+	}
+}
+
+template<class TK, class TV>
+void zHash<TK, TV>::GetStats(zHashStats &Stats, size_t Samples)
+{
+    memset(&Stats, 0, sizeof(Stats));
+    for (int i = 0; i < STAT_SLOTS; ++i)
+    {
+        Stats.Hits += StatSlots[i].Hits.load(std::memory_order_relaxed);
+        Stats.Misses += StatSlots[i].Misses.load(std::memory_order_relaxed);
+        Stats.ListToTree += StatSlots[i].ListToTree.load(std::memory_order_relaxed);
+        Stats.TreeToList += StatSlots[i].TreeToList.load(std::memory_order_relaxed);
+        Stats.Evictions += StatSlots[i].Evictions.load(std::memory_order_relaxed);
+    }
+    Stats.Grows = Grows.load(std::memory_order_relaxed);
+    Stats.Shrinks = Shrinks.load(std::memory_order_relaxed);
+    Stats.ResizeNanos = ResizeNanos.load(std::memory_order_relaxed);
+    Stats.LastResizeNanos = LastResizeNanos.load(std::memory_order_relaxed);
+    Stats.Items = count();
+    Stats.DataNodes = Pool.GetUsed();
+    Stats.DataNodeCapacity = Pool.GetCapacity();
+
+    //The tables can't be freed before end()
+    begin();
+    //Reads pTab before pTabOld. See startResize()
+    TABLE *pT = pTab.load(std::memory_order_acquire);
+    TABLE *pOld = pTabOld.load(std::memory_order_acquire);
+    Stats.Buckets = pT->Buckets;
+    Stats.Resizing = pOld && pOld != pT;
+    Stats.TreeNodes = pT->pBTNodePool->GetUsed();
+    Stats.TreeNodeCapacity = pT->pBTNodePool->GetCapacity();
+    if (Stats.Resizing)
+    {
+        Stats.TreeNodes += pOld->pBTNodePool->GetUsed();
+        Stats.TreeNodeCapacity += pOld->pBTNodePool->GetCapacity();
+    }
+
+    //Samples the buckets evenly spaced from a different start each time.A linked list is inspected without lock like searchOptimistic(),
+    //and a B-tree with the read lock if it can be got at once
+    if (Samples > pT->Buckets)
+        Samples = pT->Buckets;
+    size_t Step = Samples ? pT->Buckets / Samples : 0;
+    size_t Pos = std::atomic_fetch_add_explicit(&SamplePos, 1, std::memory_order_relaxed);
+    for (size_t i = 0; i < Samples; ++i, Pos += Step)
+    {
+        ENTRY *pEntry = pT->pBucket + (Pos & pT->PosMask);
+        uint32_t Ver = pEntry->Version.load(std::memory_order_acquire);
+        if (Ver & 0x1)
+            continue;
+        bool Empty = !pEntry->p;
+        size_t Size = pEntry->Size_Type;
+        bool Moved = pEntry->Moved;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (pEntry->Version.load(std::memory_order_relaxed) != Ver || Moved)
+            continue;
+        if (Size > 0 || Empty)
+        {
+            ++Stats.ChainHist[Empty ? 0 : Size < MAX_LINKEDLIST_SIZE ? Size : MAX_LINKEDLIST_SIZE - 1];
+            ++Stats.SampledBuckets;
+        }
+        else if (pEntry->lock.TryRLock())
+        {
+            if (pEntry->p && !pEntry->Size_Type)
+            {
+                size_t n = pEntry->p->Count();
+                size_t k = 0;
+                while (k < STAT_TREE_HIST - 1 && (n >> (k + 1)))
+                    ++k;
+                ++Stats.TreeHist[k];
+                ++Stats.SampledBuckets;
+            }
+            pEntry->lock.RUnlock();
+        }
+    }
+    end();
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::TestHash(ZHASH_FUNCTION pFun,TK Key[],size_t KeyNum,size_t Buckets,size_t &FilledBuckets,size_t &Collitions,size_t &MaxCollition)
+{
+    FilledBuckets=0;
+    Collitions=0;
+    MaxCollition=0;
+    size_t *pB=(size_t*)malloc(KeyNum*sizeof(size_t));
+    if(!pB)
+        return false;
+    memset(pB,0,KeyNum*sizeof(size_t));
+    for(size_t i=0;i<KeyNum;++i)
+        ++pB[pFun(Key[i])%Buckets];
+    for(size_t i=0;i<Buckets;++i)
+    {
+        if(pB[i])
+        {
+            ++FilledBuckets;
+            if(pB[i]>=2)
+            {
+                ++Collitions;
+                if(MaxCollition<pB[i])
+                    MaxCollition=pB[i];
+            }
+        }
+    }
+    delete pB;
+    return true;
+}
+
+//代码思路:根据键值计算所得哈希值找到对应桶，同时读锁定。若再桶中找到对应记录，那么写锁定记录，更新数据，更新完成解锁返回
+//Summary:According to the calculated hash value of (Key), finds the corresponding data node without locking.
+//If the item associated with (Key) is found, locks the data node and applies (Fun) to the data if it's still in the bucket.
+//If the bucket can't be read without lock,finds the data node with the bucket read locked
+template<class TK, class TV>
+template<class K, class F>
+bool zHash<TK, TV>::compute(const K &Key, size_t h, F &&Fun)
+{
+    //The copy in the bucket entry(see INLINE_HEAD) changes with the value,so the bucket is write locked instead
+    if constexpr (INLINE_HEAD)
+        return computeLocked(Key, h, Fun);
+    DATA_NODE<TK, TV>*pD;
+    int ret;
+    int Tries = OPTIMISTIC_TRIES;
+    uint32_t Token = Epoch.Enter();
+    do {
+        ret = searchOptimistic(Key, h, pD);
+        if (ret != 1)
+            break;
+        //The item is locked by LockItem().Waits out of the epoch,because the thread holding it may wait for the readers to leave
+        if (!lockData(pD))
+        {
+            Epoch.Leave(Token);
+            waitPinned();
+            Token = Epoch.Enter();
+            Tries = OPTIMISTIC_TRIES + 1;
+            continue;
+        }
+        //The data node can't be removed while it's locked. If it has been removed before locking,searches again
+        if (!pD->Removed)
+        {
+            if (expired(pD))
+                ret = 0;
+            else
+            {
+                Fun(pD->value);
+                touch(pD);
+            }
+            pD->slock.WUnlock();
+            break;
+        }
+        pD->slock.WUnlock();
+        ret = -1;
+    } while (--Tries);
+    Epoch.Leave(Token);
+    if (ret >= 0)
+        return ret;
+
+    ENTRY *pT;
+    do {
+        pD = searchAndRLock(Key, h, pT);
+        if (!pD)	//Key is not found.The bucket isn't locked
+            return false;
+        if (lockData(pD))
+            break;
+        pT->lock.RUnlock();
+        waitPinned();
+    } while (true);
+
+    //Updates the data with the data node locked
+    bool Found = false;
+    if (!expired(pD))
+    {
+        Fun(pD->value);
+        Found = true;
+    }
+    pD->slock.WUnlock();
+    if (Found)
+        touch(pD);
+
+    // The read lock of the bucket entry can be unlocked only after the updating is complete; otherwise, it may be deleted by other threads
+    // The deleted data node may have incorrect data if it is immediately reallocated
+    pT->lock.RUnlock();
+	return Found;
+}
+
+//Summary:the same as compute(),but the data node is found and changed with the bucket write locked
+template<class TK, class TV>
+template<class K, class F>
+bool zHash<TK, TV>::computeLocked(const K &Key, size_t h, F &&Fun)
+{
+    do {
+        ENTRY *pT = lockBucket(h);
+        if (!pT)	//Key is not found.The bucket isn't locked
+            return false;
+        DATA_NODE<TK, TV> *pD = 0;
+        if (!pT->p)
+            ;
+        else if (pT->Size_Type > 0)	//If linked list
+        {
+            for (pD = (DATA_NODE<TK, TV>*)pT->p; pD; pD = pD->pNext)
+            {
+                if (h == pD->h && Key == pD->key)
+                    break;
+            }
+        }
+        else    //If B-tree
+            pD = pT->p->FindData(Key, h);
+        if (!pD || expired(pD))
+        {
+            pT->WUnlock();
+            return false;
+        }
+        //The item is locked by LockItem().Waits with the bucket unlocked
+        if (!lockData(pD))
+        {
+            pT->WUnlock();
+            waitPinned();
+            continue;
+        }
+        //The readers with the sequence lock of the data node don't lock the bucket
+        Fun(pD->value);
+        pD->slock.WUnlock();
+        touch(pD);
+        pT->WUnlock();
+        return true;
+    } while (true);
+}
+
+//Summary:the bucket is read locked by searchAndRLock(),so the data node can't be removed.The writers of the data node are locked out,
+//so the value is stable while Fun reads it,but the readers with the sequence lock go on without retrying
+template<class TK, class TV>
+template<class K, class F>
+bool zHash<TK, TV>::visitValue(const K &Key, size_t h, F &&Fun)
+{
+    ENTRY *pT;
+    DATA_NODE<TK, TV> *pD;
+    do {
+        pD = searchAndRLock(Key, h, pT);
+        if (!pD)	//Key is not found.The bucket isn't locked
+            return false;
+        if (pD->slock.TryLockWriters())
+            break;
+        //Waits with the bucket unlocked if the item is locked by LockItem()
+        bool Pinned = pD->Pinned;
+        pT->lock.RUnlock();
+        if (Pinned)
+            waitPinned();
+        else
+            std::this_thread::yield();
+    } while (true);
+    bool Found = false;
+    if (!expired(pD))
+    {
+        Fun((const TV &)pD->value);
+        Found = true;
+    }
+    pD->slock.UnlockWriters();
+    if (Found)
+        touch(pD);
+    pT->lock.RUnlock();
+    return Found;
+}
+
+//Summary:the new data node is filled before it's linked in place of the old one,with the bucket write locked.A reader without lock
+//sees either of them,and both stay valid until it leaves the epoch.The old one is marked removed,so that the writers which have found it
+//without lock(see compute()) search again and change the new one
+template<class TK, class TV>
+template<class K, class... Args>
+bool zHash<TK, TV>::replace(const K &Key, size_t h, Args&&... args)
+{
+    do {
+        ENTRY *pT;
+        TABLE *pTable = lockForInsert(h, pT);
+        if (pT)
+        {
+            DATA_NODE<TK, TV> *pOld = 0;
+            DATA_NODE<TK, TV> **ppLink = 0;	//The pointer to pOld in the bucket
+            if (pT->Size_Type > 0)	//If linked list
+            {
+                for (ppLink = (DATA_NODE<TK, TV>**)&pT->p; *ppLink; ppLink = &(*ppLink)->pNext)
+                {
+                    if (h == (*ppLink)->h && Key == (*ppLink)->key)
+                    {
+                        pOld = *ppLink;
+                        break;
+                    }
+                }
+            }
+            else if (pT->p)	//If B-tree
+            {
+                int Index;
+                zBTreeNode<TK, TV> *pBTNode = pT->p->Search(Key, h, Index);
+                if (pBTNode)
+                {
+                    ppLink = &pBTNode->Key[Index];
+                    pOld = *ppLink;
+                }
+            }
+            if (!pOld || expired(pOld))
+            {
+                pT->WUnlock();
+                return false;
+            }
+            //The item is locked by LockItem().Waits with the bucket unlocked
+            if (pOld->Pinned)
+            {
+                pT->WUnlock();
+                waitPinned();
+                continue;
+            }
+            DATA_NODE<TK, TV> *pNew = Pool.LockAlloc();
+            if (pNew)
+            {
+                new(pNew) DATA_NODE<TK, TV>(h, pOld->key, std::forward<Args>(args)...);
+                pNew->Expire.store(pOld->Expire.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                pNew->Referenced = pOld->Referenced;
+                pNew->pNext = pOld->pNext;
+                //The readers without lock may see the new data node as soon as it's linked,so it must be filled before
+                std::atomic_thread_fence(std::memory_order_release);
+                *ppLink = pNew;
+                pOld->slock.WLock();
+                pOld->Removed = true;
+                pOld->slock.WUnlock();
+                pT->WUnlock();
+                retireData(pOld);
+                return true;
+            }
+            pT->WUnlock();
+        }
+        if (!grow(pTable) && !(CacheSize && evict(1)))
+            return false;
+        //Restarts visiting before trying again,so that a thread waiting for the visitors to pause can go on
+        end();
+        begin();
+        helpResize(MOVE_STEP);
+    } while (true);
+}
+
+//Summary:the same as the optimistic path of value(),but Fun reads the value in place instead of copying it with the sequence lock.
+//If the bucket can't be read without lock,falls back to visitValue()
+template<class TK, class TV>
+template<class K, class F>
+bool zHash<TK, TV>::visitRcu(const K &Key, size_t h, F &&Fun)
+{
+    //A value which can't be copied may be moved out of a data node while resizing(see moveBucket()).Once RcuUsed is set,
+    //no resizing which starts later moves values,but one in progress may,so the value is read with the bucket locked until it ends
+    if constexpr (!std::is_copy_constructible_v<TV>)
+    {
+        if (!RcuUsed.load(std::memory_order_relaxed))
+            RcuUsed.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pTabOld.load(std::memory_order_relaxed))
+            return visitValue(Key, h, Fun);
+    }
+    DATA_NODE<TK, TV> *pD;
+    int ret;
+    int Tries = OPTIMISTIC_TRIES;
+    uint32_t Token = Epoch.Enter();
+    do {
+        ret = searchOptimistic(Key, h, pD);
+        if (ret != 1)
+            break;
+        //A removed data node has been replaced or deleted.Searches again
+        if (!pD->Removed)
+        {
+            if (expired(pD))
+                ret = 0;
+            else
+            {
+                Fun((const TV &)pD->value);
+                touch(pD);
+            }
+            break;
+        }
+        ret = -1;
+    } while (--Tries);
+    Epoch.Leave(Token);
+    if (ret >= 0)
+        return ret;
+    return visitValue(Key, h, Fun);
+}
+
+//Summary:the item is found and locked with the bucket read locked,and pinned before the bucket is unlocked.A thread which removes,overwrites
+//or moves a data node holds the bucket write lock,so it sees the pin and waits with no lock held.pCheck is called with the writers locked out,
+//and if the condition isn't met yet,everything is unlocked before waiting
+template<class TK, class TV>
+template<class K>
+bool zHash<TK, TV>::lockItem(const K &Key, size_t h, LOCKPACK &Pack, CHECK_FP pCheck, size_t Extra)
+{
+    do {
+        ENTRY *pT;
+        DATA_NODE<TK, TV> *pD = searchAndRLock(Key, h, pT);
+        if (!pD)	//Key is not found.The bucket isn't locked
+            return false;
+        if (expired(pD))
+        {
+            pT->lock.RUnlock();
+            return false;
+        }
+        if (pD->slock.TryLockWriters())
+        {
+            int ret = pCheck ? pCheck(&pD->value, Extra) : 0;
+            if (!ret)
+            {
+                pD->Pinned = true;
+                touch(pD);
+                pT->lock.RUnlock();
+                Pack.pV = &pD->value;
+                Pack.pD = pD;
+                return true;
+            }
+            pD->slock.UnlockWriters();
+            pT->lock.RUnlock();
+            if (ret < 0)
+                return false;
+        }
+        else
+            pT->lock.RUnlock();
+        //Another thread holds the item or the condition isn't met yet
+        waitPinned();
+    } while (true);
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::Update(const TK &Key, const TV *pValue)
+{
+	begin();
+    helpResize(MOVE_STEP);
+    bool ret = update(Key, hashKey(Key), pValue);
+    end();
+    return ret;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::SetInitBuckets( size_t InitBuckets)
+{
+    if (!replaceTable(roundUp(InitBuckets)))
+        return false;
+    MinBuckets = pTab.load(std::memory_order_relaxed)->Buckets;
+    return true;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::replaceTable(size_t Buckets)
+{
+    TABLE *pNew = newTable(Buckets);
+    if (!pNew)
+        return false;
+    if (Pool.GetCapacity() < pNew->Threshold && !Pool.Grow(pNew->Threshold - Pool.GetCapacity()))
+    {
+        freeTable(pNew);
+        return false;
+    }
+
+    //Frees the old resources and setups new resources
+    freeTable(pTab.load(std::memory_order_relaxed));
+    pTab.store(pNew, std::memory_order_release);
+    return true;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::SaveSnapshot(const char *Path)
+{
+    static_assert(std::is_trivially_copyable_v<TK> && std::is_trivially_copyable_v<TV>, "The snapshot needs trivially copyable TK and TV");
+    const size_t RecSize = sizeof(uint64_t) + sizeof(TK) + sizeof(TV);
+    FILE *f = fopen(Path, "wb");
+    if (!f)
+        return false;
+    //The count is written again after all records are written
+    SNAPSHOT_HEADER Header;
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.Magic, "ZZGHASH", 8);
+    Header.Version = SNAPSHOT_VERSION;
+    Header.KeySize = sizeof(TK);
+    Header.ValueSize = sizeof(TV);
+    Header.Buckets = GetBucketNum();
+    bool Ok = fwrite(&Header, sizeof(Header), 1, f) == 1;
+
+    std::vector<char> Buf(RecSize * SNAPSHOT_BLOCK);
+    size_t n = 0;
+    ForEach([&](const TK &Key, const TV &Value) {
+        char *p = Buf.data() + n * RecSize;
+        uint64_t h = hashKey(Key);
+        memcpy(p, &h, sizeof(h));
+        memcpy(p + sizeof(h), &Key, sizeof(TK));
+        memcpy(p + sizeof(h) + sizeof(TK), &Value, sizeof(TV));
+        ++Header.Count;
+        if (++n == SNAPSHOT_BLOCK)
+        {
+            Ok = Ok && fwrite(Buf.data(), RecSize, n, f) == n;
+            n = 0;
+        }
+    });
+    Ok = Ok && fwrite(Buf.data(), RecSize, n, f) == n;
+    Ok = Ok && !zFseek64(f, 0) && fwrite(&Header, sizeof(Header), 1, f) == 1;
+    Ok = !fclose(f) && Ok;
+    return Ok;
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::LoadSnapshot(const char *Path, uint32_t Threads)
+{
+    static_assert(std::is_trivially_copyable_v<TK> && std::is_trivially_copyable_v<TV>, "The snapshot needs trivially copyable TK and TV");
+    FILE *f = fopen(Path, "rb");
+    if (!f)
+        return false;
+    SNAPSHOT_HEADER Header;
+    uint64_t h;
+    TK Key;
+    bool Ok = fread(&Header, sizeof(Header), 1, f) == 1 && !memcmp(Header.Magic, "ZZGHASH", 8) && Header.Version == SNAPSHOT_VERSION
+              && Header.KeySize == sizeof(TK) && Header.ValueSize == sizeof(TV);
+    //Checks the hash function by the first record
+    if (Ok && Header.Count)
+        Ok = fread(&h, sizeof(h), 1, f) == 1 && fread(&Key, sizeof(TK), 1, f) == 1 && h == (uint64_t)hashKey(Key);
+    fclose(f);
+    if (!Ok)
+        return false;
+
+    //Allocates the table for all items at once,as large as the table when saving at least.The records are in the bucket order of that table,
+    //so the buckets are filled one after another
+    if (Resizable && !count() && !pTabOld.load(std::memory_order_relaxed))
+    {
+        size_t Buckets = roundUp((size_t)((double)Header.Count / LoadFactor) + 1);
+        if (Buckets < Header.Buckets)
+            Buckets = roundUp((size_t)Header.Buckets);
+        if (Buckets > MaxSize)
+            Buckets = MaxSize;
+        if (Buckets > GetBucketNum() && !replaceTable(Buckets))
+            return false;
+    }
+
+    //Each thread loads a part of the records with its own file
+    if (!Threads)
+        Threads = 1;
+    std::atomic_bool Failed;
+    atomic_init(&Failed, false);
+    std::vector<std::thread> Loaders;
+    uint32_t Parts = Threads;
+    for (uint32_t i = 1; i < Threads; ++i)
+    {
+        uint64_t Start = Header.Count * i / Threads, End = Header.Count * (i + 1) / Threads;
+        try {
+            Loaders.emplace_back([=, &Failed]() {
+                if (!loadRecords(Path, Start, End))
+                    Failed.store(true, std::memory_order_relaxed);
+            });
+        }
+        catch (...)
+        {
+            Parts = i;
+            break;
+        }
+    }
+    //The calling thread loads the first part,and the parts whose threads can't be started
+    Ok = loadRecords(Path, 0, Header.Count / Threads) && loadRecords(Path, Header.Count * Parts / Threads, Header.Count);
+    for (std::thread &t : Loaders)
+        t.join();
+    return Ok && !Failed.load(std::memory_order_relaxed);
+}
+
+template<class TK, class TV>
+bool zHash<TK, TV>::loadRecords(const char *Path, uint64_t Start, uint64_t End)
+{
+    const size_t RecSize = sizeof(uint64_t) + sizeof(TK) + sizeof(TV);
+    if (Start >= End)
+        return true;
+    FILE *f = fopen(Path, "rb");
+    if (!f)
+        return false;
+    if (zFseek64(f, sizeof(SNAPSHOT_HEADER) + Start * RecSize))
+    {
+        fclose(f);
+        return false;
+    }
+    std::vector<char> Buf(RecSize * SNAPSHOT_BLOCK);
+    bool Ok = true;
+    while (Ok && Start < End)
+    {
+        size_t Num = End - Start < SNAPSHOT_BLOCK ? (size_t)(End - Start) : SNAPSHOT_BLOCK;
+        if (fread(Buf.data(), RecSize, Num, f) != Num)
+        {
+            Ok = false;
+            break;
+        }
+        Start += Num;
+        begin();
+        helpResize(MOVE_STEP);
+        for (size_t i = 0; i < Num; ++i)
+        {
+            const char *p = Buf.data() + i * RecSize;
+            uint64_t h;
+            TK Key;
+            TV Value;
+            memcpy(&h, p, sizeof(h));
+            memcpy(&Key, p + sizeof(h), sizeof(TK));
+            memcpy(&Value, p + sizeof(h) + sizeof(TK), sizeof(TV));
+            if (insert(Key, (size_t)h, true, Value) == ERR_MEMORY)
+            {
+                Ok = false;
+                break;
+            }
+            //Inserting may start resizing.Helps it as much as InsertBatch() does
+            if (i % BATCH_STEP == BATCH_STEP - 1)
+                helpResize(MOVE_STEP);
+        }
+        end();
+    }
+    fclose(f);
+    return Ok;
+}
+
+template<class TK, class TV>
+template<class F>
+void zHash<TK, TV>::runThreads(uint32_t Threads, F &&Fun)
+{
+    std::vector<std::thread> Workers;
+    uint32_t Started = 1;
+    for (; Started < Threads; ++Started)
+    {
+        try {
+            Workers.emplace_back([&Fun, Started]() { Fun(Started); });
+        }
+        catch (...)
+        {
+            break;
+        }
+    }
+    Fun(0);
+    for (uint32_t i = Started; i < Threads; ++i)
+        Fun(i);
+    for (std::thread &t : Workers)
+        t.join();
+}
+
+//Summary:the items are sorted by bucket with a counting sort in two passes over the input.The first pass hashes the items and counts them
+//by part,each part being a range of buckets. The second pass puts the item numbers into their parts. Then each part is linked by its own thread,
+//which takes the data nodes from its own part of the reserved block,so that the threads never touch the same bucket or the same memory
+template<class TK, class TV>
+template<class It>
+bool zHash<TK, TV>::bulkLoad(It First, size_t Num, const size_t *pIdx, uint32_t Threads)
+{
+    if (!Num)
+        return true;
+    //A hash table which may be visited or isn't empty is loaded by the normal insertion
+    if (!Resizable || CacheSize || count() || pTabOld.load(std::memory_order_relaxed))
+    {
+        bool Ok = true;
+        begin();
+        helpResize(MOVE_STEP);
+        for (size_t k = 0; k < Num; ++k)
+        {
+            const auto &Item = First[pIdx ? pIdx[k] : k];
+            if (insert(Item.first, hashKey(Item.first), true, Item.second) == ERR_MEMORY)
+            {
+                Ok = false;
+                break;
+            }
+            //Restarts visiting now and then,so that a thread waiting for the visitors to pause can go on
+            if (k % SCAN_CHUNK == SCAN_CHUNK - 1)
+            {
+                end();
+                begin();
+                helpResize(MOVE_STEP);
+            }
+        }
+        end();
+        return Ok;
+    }
+
+    if (!Threads)
+        Threads = std::thread::hardware_concurrency();
+    if (Threads > Num / BULK_MIN)
+        Threads = (uint32_t)(Num / BULK_MIN);
+    if (!Threads)
+        Threads = 1;
+    //Counts[t*Threads+p] is the number of the items of part p hashed by thread t,and then the position of the next of them in Order
+    std::vector<size_t> H(Num), Order(Num), Counts((size_t)Threads * Threads, 0), PartStart(Threads + 1);
+
+    //The data nodes are reserved first,so that the pool grows no more for the new table
+    DATA_NODE<TK, TV> *pNodes = Pool.Reserve(Num);
+    if (!pNodes)
+        return false;
+    size_t Buckets = roundUp((size_t)((double)Num / LoadFactor) + 1);
+    if (Buckets > MaxSize)
+        Buckets = MaxSize;
+    if (Buckets > GetBucketNum() && !replaceTable(Buckets))
+    {
+        for (size_t i = 0; i < Num; ++i)
+            Pool.LockFree(pNodes + i);
+        return false;
+    }
+    TABLE *pT = pTab.load(std::memory_order_relaxed);
+    size_t PartSize = (pT->Buckets + Threads - 1) / Threads;
+
+    runThreads(Threads, [&](uint32_t t) {
+        size_t *pCount = Counts.data() + (size_t)t * Threads;
+        for (size_t k = Num * t / Threads, End = Num * (t + 1) / Threads; k < End; ++k)
+        {
+            H[k] = hashKey(First[pIdx ? pIdx[k] : k].first);
+            ++pCount[(H[k] & pT->PosMask) / PartSize];
+        }
+    });
+    size_t Pos = 0;
+    for (uint32_t p = 0; p < Threads; ++p)
+    {
+        PartStart[p] = Pos;
+        for (uint32_t t = 0; t < Threads; ++t)
+        {
+            size_t Count = Counts[(size_t)t * Threads + p];
+            Counts[(size_t)t * Threads + p] = Pos;
+            Pos += Count;
+        }
+    }
+    PartStart[Threads] = Num;
+    //The items of a part keep their order in the input,so the last one of the same keys is linked last
+    runThreads(Threads, [&](uint32_t t) {
+        size_t *pCount = Counts.data() + (size_t)t * Threads;
+        for (size_t k = Num * t / Threads, End = Num * (t + 1) / Threads; k < End; ++k)
+            Order[pCount[(H[k] & pT->PosMask) / PartSize]++] = k;
+    });
+
+    std::atomic_size_t Added;
+    atomic_init(&Added, 0);
+    std::atomic_bool Failed;
+    atomic_init(&Failed, false);
+    runThreads(Threads, [&](uint32_t t) {
+        size_t Next = PartStart[t];	//The next free data node of the part
+        for (size_t j = PartStart[t]; j < PartStart[t + 1]; ++j)
+        {
+            size_t k = Order[j];
+            size_t h = H[k];
+            const auto &Item = First[pIdx ? pIdx[k] : k];
+            ENTRY *pEntry = pT->pBucket + (h & pT->PosMask);
+            DATA_NODE<TK, TV> *pD = 0;
+            if (!pEntry->p)
+                ;
+            else if (pEntry->Size_Type > 0)
+            {
+                for (pD = (DATA_NODE<TK, TV>*)pEntry->p; pD; pD = pD->pNext)
+                    if (h == pD->h && Item.first == pD->key)
+                        break;
+            }
+            else
+            {
+                int Index;
+                zBTreeNode<TK, TV> *pBTNode = pEntry->p->Search(Item.first, h, Index);
+                if (pBTNode)
+                    pD = pBTNode->Key[Index];
+            }
+            if (pD)
+            {
+                pD->value = Item.second;
+                pEntry->refreshCopy();
+                continue;
+            }
+            pD = pNodes + Next;
+            new(pD) DATA_NODE<TK, TV>(h, Item.first, Item.second);
+            if (!linkData(pT, pEntry, pD))
+            {
+                pD->~DATA_NODE();
+                Failed.store(true, std::memory_order_relaxed);
+                break;
+            }
+            pEntry->refreshCopy();
+            ++Next;
+        }
+        std::atomic_fetch_add_explicit(&Added, Next - PartStart[t], std::memory_order_relaxed);
+        //The data nodes left by the repeated keys are returned to the pool
+        for (size_t i = Next; i < PartStart[t + 1]; ++i)
+            Pool.LockFree(pNodes + i);
+    });
+
+    //Counts the items at once.The table may be too small only if MaxSize is reached
+    begin();
+    int64_t Count = std::atomic_fetch_add_explicit(&DataCount, (int64_t)Added.load(std::memory_order_relaxed), std::memory_order_relaxed)
+                    + (int64_t)Added.load(std::memory_order_relaxed);
+    if (Count >= (int64_t)pT->Threshold)
+        startResize(pT, true);
+    end();
+    return !Failed.load(std::memory_order_relaxed);
+}
+
+//*************************************************************/
+/*********zShardedHash*************/
+/**************************************************************/
+#define MAX_SHARDS	1024	//The maximum number of shards of zShardedHash.zHash::fingerprint() avoids the top 10 bits of the hash which choose the shard
+#define SHARDS_PER_THREAD	4	//The default number of shards is the number of hardware threads multiplied by this,rounded up to a power of 2
+
+//zShardedHash is a thread-safe hash table made of several zHash shards. The shard of a key is selected by the high bits of its hash,
+//and the bucket in the shard by the low bits,so the items spread evenly over the shards and over the buckets of each shard.
+//Each shard is visited,resized and shrunk independently. The functions have the same meaning as those of zHash.
+//Use it instead of zHash when many threads visit the hash table at the same time
+template<class TK, class TV>
+class zShardedHash
+{
+    typedef zHash<TK, TV> SHARD;
+    typedef typename SHARD::ZHASH_FUNCTION ZHASH_FUNCTION;
+    typedef typename SHARD::ZHASH_VIEW_FUNCTION ZHASH_VIEW_FUNCTION;
+    typedef typename SHARD::KEY_VIEW KEY_VIEW;
+    template <class K>
+    static constexpr bool IS_VIEW = SHARD::template IS_VIEW<K>;
+
+    SHARD *pShards;	//The shards
+    uint32_t ShardNum;	//The number of shards.It's always an integer power of 2
+    uint32_t Shift;	//The hash is shifted right by Shift bits to get the shard number
+    volatile bool ReaperRun;	//true while the reaper thread started by StartReaper() should go on.The thread sets it again on exit
+    bool HasReaper;	//true if the reaper thread has been started
+
+public:
+    typedef typename SHARD::LOCKPACK LOCKPACK;	//See zHash::LockItem()
+    typedef typename SHARD::CHECK_FP CHECK_FP;
+
+    //@para[Shards:in]:the number of shards.It's rounded up to a power of 2 and cut to MAX_SHARDS.
+    //0 means SHARDS_PER_THREAD times the number of hardware threads
+    //If memory allocation fails,std::bad_alloc is thrown
+    zShardedHash(uint32_t Shards = 0)
+    {
+        if (!Shards)
+            Shards = std::thread::hardware_concurrency() * SHARDS_PER_THREAD;
+        if (Shards > MAX_SHARDS)
+            Shards = MAX_SHARDS;
+        ShardNum = 1;
+        Shift = sizeof(size_t) * 8;
+        while (ShardNum < Shards)
+        {
+            ShardNum <<= 1;
+            --Shift;
+        }
+        ReaperRun = false;
+        HasReaper = false;
+        pShards = new SHARD[ShardNum];
+    }
+    ~zShardedHash()
+    {
+        if (HasReaper)
+        {
+            ReaperRun = false;
+            zWaitUntil(ReaperRun, true);
+        }
+        delete[] pShards;
+    }
+
+    //See zHash::Insert()
+    int Insert(const TK &Key, const TV &Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insert(Key, h, false, Value); });
+    }
+    int Insert(TK &&Key, TV &&Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insert(std::move(Key), h, false, std::move(Value)); });
+    }
+
+    //See zHash::Emplace()
+    template <class K, class... Args>
+    int Emplace(K &&Key, Args&&... args)
+    {
+        if constexpr (IS_VIEW<K>)
+        {
+            KEY_VIEW View(Key);
+            size_t h = pShards->hashKey(View);
+            SHARD &S = shard(h);
+            return visit(S, [&]() { return S.insert(View, h, false, std::forward<Args>(args)...); });
+        }
+        else if constexpr (std::is_same_v<std::decay_t<K>, TK>)
+        {
+            size_t h = pShards->hashKey(Key);
+            SHARD &S = shard(h);
+            return visit(S, [&]() { return S.insert(std::forward<K>(Key), h, false, std::forward<Args>(args)...); });
+        }
+        else
+        {
+            TK NewKey(std::forward<K>(Key));
+            size_t h = pShards->hashKey(NewKey);
+            SHARD &S = shard(h);
+            return visit(S, [&]() { return S.insert(std::move(NewKey), h, false, std::forward<Args>(args)...); });
+        }
+    }
+
+    //See zHash::Upsert()
+    bool Upsert(const TK &Key, const TV &Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insert(Key, h, true, Value); }) != SHARD::ERR_MEMORY;
+    }
+    bool Upsert(TK &&Key, TV &&Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insert(std::move(Key), h, true, std::move(Value)); }) != SHARD::ERR_MEMORY;
+    }
+
+    //See zHash::Value()
+    bool Value(const TK &Key, TV *pRet)
+    {
+        return value(Key, pShards->hashKey(Key), pRet);
+    }
+    template <class K, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Value(const K &Key, TV *pRet)
+    {
+        KEY_VIEW View(Key);
+        return value(View, pShards->hashKey(View), pRet);
+    }
+
+    //See zHash::Del()
+    bool Del(const TK &Key, TV *pRet = 0)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.del(Key, h, pRet); });
+    }
+    template <class K, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Del(const K &Key, TV *pRet = 0)
+    {
+        KEY_VIEW View(Key);
+        size_t h = pShards->hashKey(View);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.del(View, h, pRet); });
+    }
+
+    //See zHash::Update()
+    bool Update(const TK &Key, const TV &Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.update(Key, h, &Value); });
+    }
+    template <class K, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Update(const K &Key, const TV &Value)
+    {
+        KEY_VIEW View(Key);
+        size_t h = pShards->hashKey(View);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.update(View, h, &Value); });
+    }
+
+    //See zHash::Compute()
+    template <class F>
+    bool Compute(const TK &Key, F &&Fun)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.compute(Key, h, Fun); });
+    }
+    template <class K, class F, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Compute(const K &Key, F &&Fun)
+    {
+        KEY_VIEW View(Key);
+        size_t h = pShards->hashKey(View);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.compute(View, h, Fun); });
+    }
+
+    //See zHash::ComputeIfAbsent()
+    template <class F>
+    int ComputeIfAbsent(const TK &Key, const TV &Init, F &&Fun)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insert(Key, h, true, typename SHARD::template COMPUTE<F>{Init, Fun}); });
+    }
+
+    //See zHash::FetchAdd()
+    bool FetchAdd(const TK &Key, TV Delta, TV *pOld = 0)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.fetchAdd(Key, h, Delta, pOld); });
+    }
+
+    //See zHash::Visit()
+    template <class F>
+    bool Visit(const TK &Key, F &&Fun)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        bool ret = visit(S, [&]() { return S.visitValue(Key, h, Fun); });
+        S.countLookups(ret, !ret);
+        return ret;
+    }
+    template <class K, class F, std::enable_if_t<IS_VIEW<K>, int> = 0>
+    bool Visit(const K &Key, F &&Fun)
+    {
+        KEY_VIEW View(Key);
+        size_t h = pShards->hashKey(View);
+        SHARD &S = shard(h);
+        bool ret = visit(S, [&]() { return S.visitValue(View, h, Fun); });
+        S.countLookups(ret, !ret);
+        return ret;
+    }
+
+    //See zHash::Replace()
+    bool Replace(const TK &Key, const TV &Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.replace(Key, h, Value); });
+    }
+    bool Replace(const TK &Key, TV &&Value)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.replace(Key, h, std::move(Value)); });
+    }
+
+    //See zHash::VisitRcu()
+    template <class F>
+    bool VisitRcu(const TK &Key, F &&Fun)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        bool ret = visit(S, [&]() { return S.visitRcu(Key, h, Fun); });
+        S.countLookups(ret, !ret);
+        return ret;
+    }
+
+    //See zHash::LockItem()
+    bool LockItem(const TK &Key, LOCKPACK &Pack, CHECK_FP pCheck = 0, size_t Extra = 0)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.lockItem(Key, h, Pack, pCheck, Extra); });
+    }
+
+    //See zHash::UnlockItem()
+    void UnlockItem(LOCKPACK &Pack, const TV *pValue = 0)
+    {
+        shard(Pack.pD->h).UnlockItem(Pack, pValue);
+    }
+
+    //See zHash::BulkLoad(). The items are grouped by shard first,then the shards are loaded one after another,each with (Threads) threads
+    template <class It>
+    bool BulkLoad(It First, It Last, uint32_t Threads = 0)
+    {
+        static_assert(std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<It>::iterator_category>,
+                      "BulkLoad() needs random access iterators");
+        size_t Num = (size_t)(Last - First);
+        std::vector<size_t> Idx(Num), Start(ShardNum + 1, 0);
+        std::vector<uint16_t> Shard(Num);
+        for (size_t i = 0; i < Num; ++i)
+        {
+            size_t h = pShards->hashKey(First[i].first);
+            Shard[i] = (uint16_t)(ShardNum > 1 ? h >> Shift : 0);
+            ++Start[Shard[i] + 1];
+        }
+        for (uint32_t s = 0; s < ShardNum; ++s)
+            Start[s + 1] += Start[s];
+        std::vector<size_t> Next(Start.begin(), Start.end() - 1);
+        for (size_t i = 0; i < Num; ++i)
+            Idx[Next[Shard[i]]++] = i;
+        bool Ok = true;
+        for (uint32_t s = 0; s < ShardNum; ++s)
+            Ok = pShards[s].bulkLoad(First, Start[s + 1] - Start[s], Idx.data() + Start[s], Threads) && Ok;
+        return Ok;
+    }
+
+    //See zHash::InsertWithTTL()
+    int InsertWithTTL(const TK &Key, const TV &Value, uint64_t TTL)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insertWithTTL(Key, h, Value, TTL, false); });
+    }
+    //See zHash::UpsertWithTTL()
+    bool UpsertWithTTL(const TK &Key, const TV &Value, uint64_t TTL)
+    {
+        size_t h = pShards->hashKey(Key);
+        SHARD &S = shard(h);
+        return visit(S, [&]() { return S.insertWithTTL(Key, h, Value, TTL, true); }) != SHARD::ERR_MEMORY;
+    }
+
+    //See zHash::ReapExpired(). Each shard has its own expiration wheel
+    size_t ReapExpired()
+    {
+        size_t Count = 0;
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            Count += pShards[i].ReapExpired();
+        return Count;
+    }
+    //See zHash::StartReaper(). One thread reaps all shards
+    bool StartReaper()
+    {
+        if (ReaperRun)
+            return true;
+        ReaperRun = true;
+        try {
+            std::thread([this]() {
+                while (ReaperRun)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(TTL_TICK));
+                    if (ReaperRun)
+                        ReapExpired();
+                }
+                ReaperRun = true;   //Tells the destructor that the thread has exited
+            }).detach();
+        }
+        catch (...)
+        {
+            ReaperRun = false;
+            return false;
+        }
+        HasReaper = true;
+        return true;
+    }
+
+    //See zHash::ForEach(). The shards are scanned one after another
+    template <class F>
+    size_t ForEach(F &&Fun)
+    {
+        return ParallelForEach(1, Fun);
+    }
+    template <class F>
+    size_t ParallelForEach(uint32_t Threads, F &&Fun)
+    {
+        size_t Count = 0;
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            Count += pShards[i].ParallelForEach(Threads, Fun);
+        return Count;
+    }
+
+    //Gets the number of shards
+    uint32_t GetShardNum()
+    {
+        return ShardNum;
+    }
+
+    //Gets the total number of buckets of all shards
+    size_t GetBucketNum()
+    {
+        size_t Buckets = 0;
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            Buckets += pShards[i].GetBucketNum();
+        return Buckets;
+    }
+
+    //Returns true if any shard is resizing
+    bool IsResizing()
+    {
+        for (uint32_t i = 0; i < ShardNum; ++i)
+        {
+            if (pShards[i].IsResizing())
+                return true;
+        }
+        return false;
+    }
+
+    //Gets the statistics of all shards. The counters,the sizes and the histograms are summed,and LastResizeNanos is the largest of the shards.
+    //Resizing is true if any shard is resizing. See zHash::GetStats()
+    //@para[Samples:in]:the number of buckets to inspect in each shard
+    void GetStats(zHashStats &Stats, size_t Samples = 64)
+    {
+        pShards[0].GetStats(Stats, Samples);
+        for (uint32_t i = 1; i < ShardNum; ++i)
+        {
+            zHashStats Shard;
+            pShards[i].GetStats(Shard, Samples);
+            Stats.Hits += Shard.Hits;
+            Stats.Misses += Shard.Misses;
+            Stats.ListToTree += Shard.ListToTree;
+            Stats.TreeToList += Shard.TreeToList;
+            Stats.Evictions += Shard.Evictions;
+            Stats.Grows += Shard.Grows;
+            Stats.Shrinks += Shard.Shrinks;
+            Stats.ResizeNanos += Shard.ResizeNanos;
+            if (Stats.LastResizeNanos < Shard.LastResizeNanos)
+                Stats.LastResizeNanos = Shard.LastResizeNanos;
+            Stats.Items += Shard.Items;
+            Stats.Buckets += Shard.Buckets;
+            Stats.Resizing = Stats.Resizing || Shard.Resizing;
+            Stats.DataNodes += Shard.DataNodes;
+            Stats.DataNodeCapacity += Shard.DataNodeCapacity;
+            Stats.TreeNodes += Shard.TreeNodes;
+            Stats.TreeNodeCapacity += Shard.TreeNodeCapacity;
+            Stats.SampledBuckets += Shard.SampledBuckets;
+            for (int k = 0; k < MAX_LINKEDLIST_SIZE; ++k)
+                Stats.ChainHist[k] += Shard.ChainHist[k];
+            for (int k = 0; k < STAT_TREE_HIST; ++k)
+                Stats.TreeHist[k] += Shard.TreeHist[k];
+        }
+    }
+
+    //The following settings apply to every shard. Like those of zHash,they must be done before any data operation
+
+    //Sets the initial number of buckets of all shards.Each shard gets an equal part of it
+    bool SetInitBuckets(size_t InitBuckets)
+    {
+        size_t Buckets = InitBuckets / ShardNum;
+        for (uint32_t i = 0; i < ShardNum; ++i)
+        {
+            if (!pShards[i].SetInitBuckets(Buckets ? Buckets : 1))
+                return false;
+        }
+        return true;
+    }
+    void SetHashFunction(ZHASH_FUNCTION pFun, ZHASH_VIEW_FUNCTION pViewFun = 0)
+    {
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            pShards[i].SetHashFunction(pFun, pViewFun);
+    }
+    bool SetLoadFactor(double LoadFactor)
+    {
+        for (uint32_t i = 0; i < ShardNum; ++i)
+        {
+            if (!pShards[i].SetLoadFactor(LoadFactor))
+                return false;
+        }
+        return true;
+    }
+    void SetResizeThreads(uint32_t Num)
+    {
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            pShards[i].SetResizeThreads(Num);
+    }
+
+    //See zHash::SetCacheSize(). Each shard is a cache of its share of (MaxItems),and evicts on its own
+    void SetCacheSize(size_t MaxItems)
+    {
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            pShards[i].SetCacheSize((MaxItems + ShardNum - 1) / ShardNum);
+    }
+    void SetCacheBytes(size_t Bytes)
+    {
+        for (uint32_t i = 0; i < ShardNum; ++i)
+            pShards[i].SetCacheBytes((Bytes + ShardNum - 1) / ShardNum);
+    }
+
+private:
+    //Gets the shard of the hash (h)
+    SHARD &shard(size_t h)
+    {
+        return pShards[ShardNum > 1 ? h >> Shift : 0];
+    }
+
+    //Calls Fun() between begin() and end() of the shard (S),as the functions of zHash do
+    template <class F>
+    static auto visit(SHARD &S, F &&Fun)
+    {
+        S.begin();
+        S.helpResize(MOVE_STEP);
+        auto ret = Fun();
+        S.end();
+        return ret;
+    }
+
+    template <class K>
+    bool value(const K &Key, size_t h, TV *pRet)
+    {
+        SHARD &S = shard(h);
+        bool ret = visit(S, [&]() { return S.value(Key, h, pRet); });
+        S.countLookups(ret, !ret);
+        return ret;
+    }
+};
+
+//*************************************************************/
+/*********zFlatHash*************/
+/**************************************************************/
+#define FLAT_GROUP_SIZE	16	//The number of slots of a group. The control bytes of a group are compared at once by one SSE2 instruction
+#define FLAT_EMPTY	((int8_t)-128)	//Control byte of an empty slot
+#define FLAT_DELETED	((int8_t)-2)	//Control byte of a slot whose item has been deleted
+
+//zFlatHash is an open-addressing hash table for small trivially copyable keys and values. It has the same thread-safety contract as zHash.
+//The items are stored in a flat slot array instead of data nodes, so reading an item never chases a pointer.
+//Each slot has a control byte.It's FLAT_EMPTY,FLAT_DELETED,or the lower 7 bits of the hash(H2) of the key in the slot.
+//The slots are divided into groups of FLAT_GROUP_SIZE. The rest bits of the hash select the first group to probe,and the following groups
+//are probed in triangular order until a group with an empty slot is found. The 16 control bytes of a group are compared with H2 at once,
+//and the keys are compared only in the matched slots.
+//Each group has a read/write lock. A reader read locks the groups one by one while probing. A writer write locks the first group
+//of the key during the whole operation,so that all operations of the same key are serialized,and locks the other groups only while reading
+//or changing them. The other groups are locked without waiting,otherwise two writers might wait for each other.
+//Resizing pauses the hash table like zHash does before incremental resizing,because the items of a flat table can't be moved one by one.
+template<class TK, class TV>
+class zFlatHash
+{
+    static_assert(std::is_trivially_copyable_v<TK> && std::is_trivially_copyable_v<TV>, "zFlatHash only stores trivially copyable keys and values");
+    //Do not change the values of these codes, because some functions use numeric values directly
+	enum RETURN_CODE{
+        HASH_KEY_EXIST=1,	//the key exists
+        ERR_MEMORY	=-1,	//memory error
+        SUCCESS	=0	//succeeds
+	};
+    //Defines the type of hash function. The same as zHash
+    typedef size_t(*ZHASH_FUNCTION)(const TK &Key);
+
+    struct SLOT {
+        TK key;
+        TV value;
+    };
+
+    int8_t *pCtrl;	//Control bytes,one for each slot
+    SLOT *pSlot;	//Slot array
+    zRWLock *pLock;	//Read/write locks,one for each group
+    size_t Groups;	//Total number of groups.It's always an integer power of 2
+    size_t GroupMask;	//Groups minus 1
+    size_t Threshold;	//Maximum number of used slots(with an item or deleted). The table is resized when it's reached
+    std::atomic_size_t DataCount;	//Current total number of items
+    std::atomic_size_t UsedCount;	//Current number of slots which are not empty. Deleted slots are still used until resizing
+    volatile bool FlagResize;	//If true,the hash table is paused for resizing
+    zLock ResizeLock;	//Only one thread is allowed to resize at a time
+    volatile std::atomic_uint32_t Vistors;	//Number of threads visiting
+    ZHASH_FUNCTION pHashFun;	//The pointer to the hash function
+
+public:
+    //@para[InitSlots:in]:initial number of slots.It's rounded up to a multiple of FLAT_GROUP_SIZE which is a power of 2.
+    //The default is 256
+    //If memory allocation fails,std::bad_alloc is thrown
+    zFlatHash(size_t InitSlots = 256);
+
+	~zFlatHash()
+	{
+        close();
+    }
+
+    //Inserts an item(Key,*pValue)
+    //@ret:SUCCESS on success
+    //HASH_KEY_EXIST if Key already exists,ERR_MEMORY if resizing fails
+    int Insert(TK Key, const TV *pValue);
+
+	int Insert(TK Key, TV Value)
+	{
+		return Insert(Key, &Value);
+	}
+
+    //Inserts/updates an item(Key,*pValue).
+    //@ret:true on success,false if resizing fails
+    bool Upsert(TK Key, const TV *pValue);
+
+	bool Upsert(TK Key, TV Value)
+	{
+		return Upsert(Key, &Value);
+	}
+
+    //Gets the value associated with Key.
+    //Returns true on success.The value is stored in the buffer Ret pointing to
+    //Returns false if zFlatHash contains no item with Key
+	bool Value(TK Key, TV *pRet);
+
+    //Deletes the item assosiated with Key.
+    //@para[pRet:in/out]:If pRet isn't 0,the deleted value is stored in *pRet
+    //@ret:true if the item exists and deleted,false if zFlatHash does not contain the item
+	bool Del(TK Key, TV *pRet = 0);
+
+    //Updates the item assosiated with Key
+    //@ret:true if the item exists and is updated,false if the item doesn't exist
+	bool Update(TK Key, const TV *pValue);
+
+    bool Update(TK Key, TV Value)
+    {
+        return Update(Key, &Value);
+    }
+
+    //Gets current total number of slots
+    size_t GetSlotNum()
+    {
+        return Groups * FLAT_GROUP_SIZE;
+    }
+
+    //Gets current total number of items
+    size_t Count()
+    {
+        return DataCount.load(std::memory_order_relaxed);
+    }
+
+    //Sets a new hash function to replace the default
+    //This function must be executed before any data operation (insert, delete, modify, read) is performed
+    void SetHashFunction(ZHASH_FUNCTION pFun)
+    {
+        pHashFun = pFun;
+    }
+
+private:
+    //Returns a bit mask of the slots of the group (pC) whose control bytes are equal to (c).The lowest bit is the first slot
+    static uint32_t match(const int8_t *pC, int8_t c)
+    {
+#if defined(ZZG_SSE2)
+        __m128i Ctrl = _mm_loadu_si128((const __m128i*)pC);
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(Ctrl, _mm_set1_epi8(c)));
+#else
+        uint32_t Mask = 0;
+        for (int i = 0; i < FLAT_GROUP_SIZE; ++i)
+            if (pC[i] == c)
+                Mask |= 1U << i;
+        return Mask;
+#endif
+    }
+
+    //Returns a bit mask of the empty or deleted slots of the group (pC). Only their control bytes are negative
+    static uint32_t matchFree(const int8_t *pC)
+    {
+#if defined(ZZG_SSE2)
+        return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)pC));
+#else
+        uint32_t Mask = 0;
+        for (int i = 0; i < FLAT_GROUP_SIZE; ++i)
+            if (pC[i] < 0)
+                Mask |= 1U << i;
+        return Mask;
+#endif
+    }
+
+    //Gets the index of the lowest 1 of Mask,and clears it
+    static uint32_t popLowest(uint32_t &Mask)
+    {
+        unsigned long Index;
+        zBSF(&Index, Mask);
+        Mask &= Mask - 1;
+        return (uint32_t)Index;
+    }
+
+    //Allocates the arrays for (NewGroups) groups and sets all slots empty.
+    //@ret:true on success,false if memory allocation fails.In such case nothing is changed
+    bool alloc(size_t NewGroups, int8_t *&pC, SLOT *&pS, zRWLock *&pL);
+
+    //Searches (Key) in the groups on its probing sequence. The first group must be write locked by the caller
+    //@para[Group,Pos:out]:the group and the position in the group of the slot containing (Key),if found
+    //@para[FreeGroup,FreePos:out]:the first empty or deleted slot on the probing sequence.FreeGroup is Groups if there's none
+    //@ret:1 if found,0 if not found,-1 if a group can't be locked without waiting.In such case the caller should unlock
+    //the first group and try again
+    int search(const TK &Key, size_t h, size_t &Group, uint32_t &Pos, size_t &FreeGroup, uint32_t &FreePos);
+
+    //Pauses the hash table and rehashes all items into a new slot array. The size is doubled unless most used slots are deleted ones.
+    //Must be called without visiting,that is,after end()
+    //@ret:true if the insertion should be tried again,false if memory allocation fails
+    bool grow();
+
+    void close()
+    {
+        free(pCtrl);
+        free(pSlot);
+        delete[] pLock;
+    }
+
+    //Waits for all threads to pause
+	void waitVisitorsPause(void)
+	{
+        volatile int count = 3;
+		do {
+			if (!count)
+			{
+                std::this_thread::yield();
+				count = 3;
+			}
+            else if (!Vistors)//stops waiting if there's no thread running
+                break;
+			--count;
+			for (int i = 0; i < 31; ++i)
+                zNop8();
+        } while (true);
+	}
+
+    //All public functions must call begin() first,and call end() at last. See zHash::begin()
+	void begin()
+    {
+        std::atomic_fetch_add_explicit(&Vistors,1,std::memory_order_acquire);
+        if(FlagResize)//If paused,wait untill it is finished
+        {
+            std::atomic_fetch_sub_explicit(&Vistors,1,std::memory_order_acquire);
+            zWaitUntil(FlagResize,false);
+            std::atomic_fetch_add_explicit(&Vistors,1,std::memory_order_acq_rel);
+        }
+	}
+
+	void end()
+	{
+        std::atomic_fetch_sub_explicit(&Vistors,1,std::memory_order_release);
+	}
+
+    //Round the input number up to an integer power of 2
+	static size_t roundUp(size_t X)
+	{
+		size_t tmp = X;
+		size_t ret = 1;
+		while (X >>= 1)
+			ret <<= 1;
+        return ret < tmp ? ret << 1 : ret;
+	}
+};
+
+template<class TK, class TV>
+zFlatHash<TK, TV>::zFlatHash(size_t InitSlots)
+{
+    atomic_init(&Vistors, 0);
+    atomic_init(&DataCount, 0);
+    atomic_init(&UsedCount, 0);
+    FlagResize = false;
+    pHashFun = zHashFun;
+    Groups = roundUp((InitSlots + FLAT_GROUP_SIZE - 1) / FLAT_GROUP_SIZE);
+    if (!Groups)
+        Groups = 1;
+    if (!alloc(Groups, pCtrl, pSlot, pLock))
+        throw std::bad_alloc();
+    GroupMask = Groups - 1;
+    Threshold = Groups * FLAT_GROUP_SIZE * 7 / 8;
+}
+
+template<class TK, class TV>
+bool zFlatHash<TK, TV>::alloc(size_t NewGroups, int8_t *&pC, SLOT *&pS, zRWLock *&pL)
+{
+    pC = (int8_t*)malloc(NewGroups * FLAT_GROUP_SIZE);
+    pS = (SLOT*)malloc(NewGroups * FLAT_GROUP_SIZE * sizeof(SLOT));
+    pL = new(nothrow) zRWLock[NewGroups];
+    if (!pC || !pS || !pL)
+    {
+        free(pC);
+        free(pS);
+        delete[] pL;
+        return false;
+    }
+    memset(pC, FLAT_EMPTY, NewGroups * FLAT_GROUP_SIZE);
     return true;
 }
+
+template<class TK, class TV>
+int zFlatHash<TK, TV>::search(const TK &Key, size_t h, size_t &Group, uint32_t &Pos, size_t &FreeGroup, uint32_t &FreePos)
+{
+    size_t g0 = (h >> 7) & GroupMask;
+    int8_t h2 = (int8_t)(h & 0x7f);
+    size_t g = g0;
+    FreeGroup = Groups;
+    for (size_t i = 1; i <= Groups; ++i)
+    {
+        //Never waits for another group while holding the first group
+        if (g != g0 && !pLock[g].TryRLock())
+            return -1;
+        int8_t *pC = pCtrl + g * FLAT_GROUP_SIZE;
+        uint32_t Mask = match(pC, h2);
+        while (Mask)
+        {
+            uint32_t b = popLowest(Mask);
+            if (pSlot[g * FLAT_GROUP_SIZE + b].key == Key)
+            {
+                if (g != g0)
+                    pLock[g].RUnlock();
+                Group = g;
+                Pos = b;
+                return 1;
+            }
+        }
+        if (FreeGroup == Groups)
+        {
+            Mask = matchFree(pC);
+            if (Mask)
+            {
+                FreeGroup = g;
+                FreePos = popLowest(Mask);
+            }
+        }
+        //A group with an empty slot ends the probing sequence,because no item has been inserted after it
+        bool Stop = match(pC, FLAT_EMPTY) != 0;
+        if (g != g0)
+            pLock[g].RUnlock();
+        if (Stop)
+            return 0;
+        g = (g + i) & GroupMask;    //Triangular probing visits all groups,because Groups is a power of 2
+    }
+    return 0;
+}
+
+template<class TK, class TV>
+bool zFlatHash<TK, TV>::grow()
+{
+    ResizeLock.Lock();
+    //Another thread may have resized the table
+    if (UsedCount < Threshold)
+    {
+        ResizeLock.Unlock();
+        return true;
+    }
+    FlagResize = true;
+    //Full memory fence.It pairs with the fetch_add in begin()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    waitVisitorsPause();
+
+    //Rehashes in a table of the same size if more than half of the used slots are deleted ones
+    size_t NewGroups = DataCount * 2 > Threshold ? Groups << 1 : Groups;
+    int8_t *pC;
+    SLOT *pS;
+    zRWLock *pL;
+    bool ret = alloc(NewGroups, pC, pS, pL);
+    if (ret)
+    {
+        size_t NewMask = NewGroups - 1;
+        for (size_t k = 0; k < Groups * FLAT_GROUP_SIZE; ++k)
+        {
+            if (pCtrl[k] < 0)
+                continue;
+            size_t h = pHashFun(pSlot[k].key);
+            size_t g = (h >> 7) & NewMask;
+            //The table is paused,so the first empty slot on the probing sequence is taken without locking
+            for (size_t i = 1;; ++i)
+            {
+                uint32_t Mask = match(pC + g * FLAT_GROUP_SIZE, FLAT_EMPTY);
+                if (Mask)
+                {
+                    size_t Pos = g * FLAT_GROUP_SIZE + popLowest(Mask);
+                    pC[Pos] = (int8_t)(h & 0x7f);
+                    pS[Pos] = pSlot[k];
+                    break;
+                }
+                g = (g + i) & NewMask;
+            }
+        }
+        close();
+        pCtrl = pC;
+        pSlot = pS;
+        pLock = pL;
+        Groups = NewGroups;
+        GroupMask = NewMask;
+        Threshold = Groups * FLAT_GROUP_SIZE * 7 / 8;
+        UsedCount = DataCount.load();
+    }
+    //Release memory fence guarantees that "FlagResize = false" is executed after the prior reads/writes
+    std::atomic_thread_fence(std::memory_order_release);
+    FlagResize = false;
+    ResizeLock.Unlock();
+    return ret;
+}
+
+template<class TK, class TV>
+int zFlatHash<TK, TV>::Insert(TK Key, const TV *pValue)
+{
+    begin();
+    do {
+        size_t h = pHashFun(Key);
+        size_t g0 = (h >> 7) & GroupMask;
+        size_t Group, FreeGroup;
+        uint32_t Pos, FreePos;
+        pLock[g0].WLock();
+        int ret = search(Key, h, Group, Pos, FreeGroup, FreePos);
+        if (ret == 1)
+        {
+            pLock[g0].WUnlock();
+            end();
+            return HASH_KEY_EXIST;
+        }
+        if (ret == -1)
+        {
+            pLock[g0].WUnlock();
+            std::this_thread::yield();
+            continue;
+        }
+        //The free slot may have been taken by another key after its group was unlocked,so checks it again after locking
+        if (FreeGroup != Groups && (FreeGroup == g0 || pLock[FreeGroup].TryWLock()))
+        {
+            int8_t *pC = pCtrl + FreeGroup * FLAT_GROUP_SIZE + FreePos;
+            if (*pC < 0 && (*pC == FLAT_DELETED || UsedCount < Threshold))
+            {
+                if (*pC == FLAT_EMPTY)
+                    std::atomic_fetch_add_explicit(&UsedCount, 1, std::memory_order_relaxed);
+                SLOT *pS = pSlot + FreeGroup * FLAT_GROUP_SIZE + FreePos;
+                pS->key = Key;
+                pS->value = *pValue;
+                *pC = (int8_t)(h & 0x7f);
+                if (FreeGroup != g0)
+                    pLock[FreeGroup].WUnlock();
+                pLock[g0].WUnlock();
+                std::atomic_fetch_add_explicit(&DataCount, 1, std::memory_order_relaxed);
+                end();
+                return SUCCESS;
+            }
+            if (FreeGroup != g0)
+                pLock[FreeGroup].WUnlock();
+            pLock[g0].WUnlock();
+            //The table is full
+            if (*pC < 0)
+            {
+                end();
+                if (!grow())
+                    return ERR_MEMORY;
+                begin();
+            }
+            continue;
+        }
+        pLock[g0].WUnlock();
+        if (FreeGroup == Groups)
+        {
+            end();
+            if (!grow())
+                return ERR_MEMORY;
+            begin();
+        }
+        else
+            std::this_thread::yield();
+    } while (true);
+}
+
+template<class TK, class TV>
+bool zFlatHash<TK, TV>::Upsert(TK Key, const TV *pValue)
+{
+    do {
+        if (Insert(Key, pValue) != HASH_KEY_EXIST)
+            return true;
+        //The key may be deleted between,so inserts again if updating fails
+        if (Update(Key, pValue))
+            return true;
+    } while (true);
+}
+
+template<class TK, class TV>
+bool zFlatHash<TK, TV>::Value(TK Key, TV *pRet)
+{
+    begin();
+    size_t h = pHashFun(Key);
+    size_t g = (h >> 7) & GroupMask;
+    int8_t h2 = (int8_t)(h & 0x7f);
+    for (size_t i = 1; i <= Groups; ++i)
+    {
+        //A reader holds no other lock,so it can wait for the group
+        pLock[g].RLock();
+        int8_t *pC = pCtrl + g * FLAT_GROUP_SIZE;
+        uint32_t Mask = match(pC, h2);
+        while (Mask)
+        {
+            SLOT *pS = pSlot + g * FLAT_GROUP_SIZE + popLowest(Mask);
+            if (pS->key == Key)
+            {
+                *pRet = pS->value;
+                pLock[g].RUnlock();
+                end();
+                return true;
+            }
+        }
+        bool Stop = match(pC, FLAT_EMPTY) != 0;
+        pLock[g].RUnlock();
+        if (Stop)
+            break;
+        g = (g + i) & GroupMask;
+    }
+    end();
+    return false;
+}
+
+template<class TK, class TV>
+bool zFlatHash<TK, TV>::Del(TK Key, TV *pRet)
+{
+    begin();
+    do {
+        size_t h = pHashFun(Key);
+        size_t g0 = (h >> 7) & GroupMask;
+        size_t Group, FreeGroup;
+        uint32_t Pos, FreePos;
+        pLock[g0].WLock();
+        int ret = search(Key, h, Group, Pos, FreeGroup, FreePos);
+        if (!ret)
+        {
+            pLock[g0].WUnlock();
+            end();
+            return false;
+        }
+        //The key can't be moved or deleted by another thread while the first group is locked
+        if (ret == -1 || (Group != g0 && !pLock[Group].TryWLock()))
+        {
+            pLock[g0].WUnlock();
+            std::this_thread::yield();
+            continue;
+        }
+        int8_t *pC = pCtrl + Group * FLAT_GROUP_SIZE;
+        if (pRet)
+            *pRet = pSlot[Group * FLAT_GROUP_SIZE + Pos].value;
+        //If the group has an empty slot,no probing sequence goes through it,so the slot can be empty again.
+        //Otherwise it's marked deleted to keep the probing sequences of the other keys
+        if (match(pC, FLAT_EMPTY))
+        {
+            pC[Pos] = FLAT_EMPTY;
+            std::atomic_fetch_sub_explicit(&UsedCount, 1, std::memory_order_relaxed);
+        }
+        else
+            pC[Pos] = FLAT_DELETED;
+        if (Group != g0)
+            pLock[Group].WUnlock();
+        pLock[g0].WUnlock();
+        std::atomic_fetch_sub_explicit(&DataCount, 1, std::memory_order_relaxed);
+        end();
+        return true;
+    } while (true);
+}
+
+template<class TK, class TV>
+bool zFlatHash<TK, TV>::Update(TK Key, const TV *pValue)
+{
+    begin();
+    do {
+        size_t h = pHashFun(Key);
+        size_t g0 = (h >> 7) & GroupMask;
+        size_t Group, FreeGroup;
+        uint32_t Pos, FreePos;
+        pLock[g0].WLock();
+        int ret = search(Key, h, Group, Pos, FreeGroup, FreePos);
+        if (!ret)
+        {
+            pLock[g0].WUnlock();
+            end();
+            return false;
+        }
+        if (ret == -1 || (Group != g0 && !pLock[Group].TryWLock()))
+        {
+            pLock[g0].WUnlock();
+            std::this_thread::yield();
+            continue;
+        }
+        pSlot[Group * FLAT_GROUP_SIZE + Pos].value = *pValue;
+        if (Group != g0)
+            pLock[Group].WUnlock();
+        pLock[g0].WUnlock();
+        end();
+        return true;
+    } while (true);
+}
 }//NAME SPACE ZZG
 #endif // !ZZG_HASH_H_2310
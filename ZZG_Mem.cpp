@@ -127,6 +127,9 @@ public:
 	//此函数必须在Init()后，LockedAlloc()/Alloc()之前使用。
 	void PreSet(size_t UnitPos);
 
+	//预先设置从Start开始的连续Num个单元为占用状态
+	void PreSetRange(size_t Start, size_t Num);
+
 	friend class zAT;
 };
 
@@ -376,6 +379,30 @@ void z__AT::PreSet(size_t UnitPos)
 	return;
 }
 
+void z__AT::PreSetRange(size_t Start, size_t Num)
+{
+	size_t End = Start + Num;
+	//不满一个叶子节点的开头和结尾逐个单元设置
+	while (Start < End && (Start & 0x1f))
+		PreSet(Start++);
+	//整个叶子节点一次设置为全0，然后和PreSet()一样逐层回溯设置父节点对应位为0
+	for (; Start + 32 <= End; Start += 32)
+	{
+		size_t UnitPos = Start >> 5;
+		*(this->pT[this->MaxLayer - 1] + UnitPos) = 0;
+		for (int i = this->MaxLayer - 2; i >= 0; --i)
+		{
+			uint16_t BitPos = UnitPos & 0x1f;
+			UnitPos >>= 5;
+			uint32_t *pUnit = this->pT[i] + UnitPos;
+			zBitReset(pUnit, BitPos);
+			if (*pUnit)break;
+		}
+	}
+	while (Start < End)
+		PreSet(Start++);
+}
+
 bool zAT::Init(size_t MaxNum)
 {
 	Count = 0;
@@ -597,6 +624,19 @@ void zAT::PreSet(size_t UnitPos)
 	else
 		pAT2->PreSet(UnitPos - Size);
 }
+void zAT::PreSetRange(size_t Start, size_t Num)
+{
+	size_t End = Start + Num;
+	//前Size个单元在pAT1，其余在pAT2
+	if (Start < Size)
+	{
+		size_t End1 = End < Size ? End : Size;
+		pAT1->PreSetRange(Start, End1 - Start);
+		Start = End1;
+	}
+	if (Start < End)
+		pAT2->PreSetRange(Start - Size, End - Start);
+}
 //得到对应单元Unit的状态，被占用返回false,否则为true
 bool zAT::GetUnitStatus(size_t Unit)
 {
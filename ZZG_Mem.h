@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <cstring>
+#include <cstdlib>
 #include "ZZG_Sync.h"
 namespace ZZG {
 
@@ -116,6 +117,10 @@ static	const size_t RET_SUCCESS	=0;	//函数成功返回值
 	//预先设置一些单元为占用状态。当分配树初始化后，所有单元都为空闲状态，用这个函数可以预设一些单元为已被分配的状态
 	//此函数必须在Init()后，LockedAlloc()/Alloc()之前使用。
 	void PreSet(size_t UnitPos);
+
+	//预先设置从Start开始的连续Num个单元为占用状态。整个叶子节点一次设置，比逐个调用PreSet()快得多
+	//使用限制和PreSet()一样
+	void PreSetRange(size_t Start, size_t Num);
 private:
 	//初始化分配树
 	//MaxNum最大分配数，此值若为0则初始化失败。最好是64的倍数，那么实际最大分配数就是MaxMum
@@ -137,6 +142,7 @@ class zMemHeap
     zAT *pAT;
 	T *pT;	//指向类T的存储区
 	size_t Count;//实际缓冲区的长度，单位为T的长度
+	std::atomic_size_t Used;	//已经分配的数量
 static	const size_t RET_MEM_FULL = ~0x0;
 
 public:
@@ -147,9 +153,11 @@ public:
 	{
 		//加1保证在最差空间利用率的情况下也能有所需分配空间
 		Count = MaxMum * 32 / (33 - FREE_THRESH_HOLD) + 1;
+		Used.store(0, std::memory_order_relaxed);
 		pAT = new zAT(Count);
 		size_t SizeCount = Count * sizeof(T);
-		pT = (T*)malloc(SizeCount);
+		//按T的对齐要求分配，比如按缓存行对齐的T，malloc不保证
+		pT = (T*)::operator new(SizeCount, std::align_val_t(alignof(T)), std::nothrow);
 		if (!pT)
 			throw std::bad_alloc();
     };
@@ -172,7 +180,10 @@ public:
 	{
 		size_t ret=pAT->Alloc();
 		if (ret != RET_MEM_FULL)
+		{
+			Used.store(Used.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 			return pT + ret;
+		}
 		return 0;
 	}
 	//释放内存。和Alloc()配合使用
@@ -180,6 +191,7 @@ public:
 	void Free(T*p)
 	{
 		pAT->Free(((size_t)p - (size_t)pT) / sizeof(T));
+		Used.store(Used.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
 	}
 
 	//多线程分配内存。和LockFree()配合使用
@@ -189,7 +201,10 @@ public:
 	{
 		size_t ret = pAT->LockedAlloc();
 		if (ret != RET_MEM_FULL)
+		{
+			std::atomic_fetch_add_explicit(&Used, 1, std::memory_order_relaxed);
 			return pT + ret;
+		}
 		return 0;
 	}
 	//多线程释放内存。和LockAlloc()配合使用
@@ -197,6 +212,16 @@ public:
 	void LockFree(T*p)
 	{
 		pAT->LockedFree(((size_t)p - (size_t)pT) / sizeof(T));
+		std::atomic_fetch_sub_explicit(&Used, 1, std::memory_order_relaxed);
+	}
+
+	//一次分配存储区开头的连续Num个单元，返回首地址。这些单元以后可以用Free()/LockFree()逐个释放
+	//必须在构造之后、其他分配之前调用，Num不能超过构造时的MaxMum
+	T *Reserve(size_t Num)
+	{
+		pAT->PreSetRange(0, Num);
+		Used.store(Num, std::memory_order_relaxed);
+		return pT;
 	}
 
 	//恢复初始状态，相当于第一次构造函数执行之后的状态。必须确保没有线程在使用本类时才可以调用本函数
@@ -204,6 +229,25 @@ public:
 	void Reset()
 	{
 		pAT->Reset();
+		Used.store(0, std::memory_order_relaxed);
+	}
+
+	//得到已经分配的数量。多线程分配释放的时候只是一个近似值
+	size_t GetUsed()
+	{
+		return Used.load(std::memory_order_relaxed);
+	}
+
+	//得到缓冲区的长度，单位为T的长度。因为分配树保留了一部分空单元，实际可以分配的数量比这个值少一点
+	size_t GetCapacity()
+	{
+		return Count;
+	}
+
+	//判断p是否指向本堆的存储区
+	bool Contains(const T *p)
+	{
+		return p >= pT && p < pT + Count;
 	}
 private:
 	//关闭释放资源
@@ -211,11 +255,199 @@ private:
 	{
 		if (pT)
         {
-            free(pT);
+            ::operator delete(pT, std::align_val_t(alignof(T)));
 		}
 		delete pAT;
 	}
 };
+//可增长的固定长度内存池。由若干个zMemHeap段组成，容量不够时调用Grow()增加新段，原有的段保持不变，
+//所以已经分配的内存地址在内存池的整个生命期内都不会改变。适用于需要扩容，但是已分配的对象不能移动的场合。
+//分配和释放都是多线程适用的，Grow()可以和分配、释放同时进行
+//收缩的时候先调用CloseLast()关闭最后一段，关闭的段不再分配。使用者把关闭段里的对象迁出并释放以后，调用Trim()释放这一段
+#define MAX_POOL_SEGMENTS	48	//最多段数。每次扩容一般增加一倍，所以足够使用
+template<class T>
+class zMemPool
+{
+	zMemHeap<T> *pSeg[MAX_POOL_SEGMENTS];	//各段，pSeg[0...SegNum-1]有效
+	size_t SegCap[MAX_POOL_SEGMENTS];	//各段最大可分配数量
+	std::atomic_uint32_t SegNum;	//段数
+	std::atomic_uint32_t AllocNum;	//可以分配的段数。最后一段关闭时比SegNum少1，否则等于SegNum
+	std::atomic_uint32_t AllocSeg;	//最近一次分配成功的段，下次分配从这个段开始尝试
+	size_t Capacity;	//可以分配的各段最大可分配数量之和
+	zLock lock;	//保证同时只有一个线程增加段
+public:
+	zMemPool()
+	{
+		SegNum.store(0, std::memory_order_relaxed);
+		AllocNum.store(0, std::memory_order_relaxed);
+		AllocSeg.store(0, std::memory_order_relaxed);
+		Capacity = 0;
+	}
+	~zMemPool()
+	{
+		uint32_t n = SegNum.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < n; ++i)
+			delete pSeg[i];
+	}
+
+	//增加一个最多可以分配Num个单元的段
+	//@ret:成功返回true。内存不足、段数已经达到MAX_POOL_SEGMENTS或者最后一段已经关闭则返回false
+	bool Grow(size_t Num)
+	{
+		return addSeg(Num, 0);
+	}
+
+	//增加一个Num个单元的段，并且一次把这些单元全部分配出去，返回它们的首地址。这些单元在内存里是连续的，
+	//调用者可以不加锁地自己分成几块使用，以后用LockFree()逐个释放
+	//@ret:成功返回首地址。失败的情况和Grow()一样，返回0
+	T *Reserve(size_t Num)
+	{
+		T *p;
+		return addSeg(Num, &p) ? p : 0;
+	}
+
+	//得到可以分配的各段最大可分配数量之和
+	size_t GetCapacity()
+	{
+		return Capacity;
+	}
+
+	//得到最后一段的最大可分配数量。只有一段的时候返回0，因为最后一段不能释放
+	size_t GetLastCapacity()
+	{
+		uint32_t n = SegNum.load(std::memory_order_acquire);
+		return n > 1 ? SegCap[n - 1] : 0;
+	}
+
+	//得到各段已经分配的数量之和。多线程分配释放的时候只是一个近似值
+	size_t GetUsed()
+	{
+		size_t Sum = 0;
+		uint32_t n = SegNum.load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < n; ++i)
+			Sum += pSeg[i]->GetUsed();
+		return Sum;
+	}
+
+	//关闭最后一段，以后不再从这一段分配。只有一段的时候不能关闭
+	//@ret:成功返回true，否则返回false
+	bool CloseLast()
+	{
+		lock.Lock();
+		uint32_t n = SegNum.load(std::memory_order_relaxed);
+		if (n < 2 || AllocNum.load(std::memory_order_relaxed) != n)
+		{
+			lock.Unlock();
+			return false;
+		}
+		Capacity -= SegCap[n - 1];
+		AllocNum.store(n - 1, std::memory_order_release);
+		lock.Unlock();
+		return true;
+	}
+
+	//判断p是否在已经关闭的最后一段里
+	bool InClosed(const T *p)
+	{
+		uint32_t n = SegNum.load(std::memory_order_acquire);
+		return AllocNum.load(std::memory_order_acquire) < n && pSeg[n - 1]->Contains(p);
+	}
+
+	//如果关闭的最后一段已经全部释放，那么释放这一段的内存；否则重新打开这一段
+	//调用的时候必须保证没有其他线程在使用本内存池
+	//@ret:释放了一段返回true，否则返回false
+	bool Trim()
+	{
+		uint32_t n = SegNum.load(std::memory_order_relaxed);
+		if (AllocNum.load(std::memory_order_relaxed) == n)
+			return false;
+		if (pSeg[n - 1]->GetUsed())
+		{
+			Capacity += SegCap[n - 1];
+			AllocNum.store(n, std::memory_order_relaxed);
+			return false;
+		}
+		delete pSeg[n - 1];
+		SegNum.store(n - 1, std::memory_order_relaxed);
+		if (AllocSeg.load(std::memory_order_relaxed) >= n - 1)
+			AllocSeg.store(0, std::memory_order_relaxed);
+		return true;
+	}
+
+	//多线程分配内存。和LockFree()配合使用
+	//成功返回指向分配的内存区的指针；所有可以分配的段都已经分配完则返回0
+	T *LockAlloc()
+	{
+		uint32_t n = AllocNum.load(std::memory_order_acquire);
+		uint32_t Start = AllocSeg.load(std::memory_order_relaxed);
+		if (Start >= n)
+			Start = 0;
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			uint32_t k = Start + i < n ? Start + i : Start + i - n;
+			T *p = pSeg[k]->LockAlloc();
+			if (p)
+			{
+				if (k != Start)
+					AllocSeg.store(k, std::memory_order_relaxed);
+				return p;
+			}
+		}
+		return 0;
+	}
+
+	//多线程释放内存。和LockAlloc()配合使用
+	void LockFree(T *p)
+	{
+		uint32_t n = SegNum.load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			if (pSeg[i]->Contains(p))
+			{
+				pSeg[i]->LockFree(p);
+				//有空闲了，下次从这个段开始分配，优先填满老的段
+				if (i < AllocNum.load(std::memory_order_relaxed) && AllocSeg.load(std::memory_order_relaxed) != i)
+					AllocSeg.store(i, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+private:
+	//增加一个最多可以分配Num个单元的段。ppReserved不为0时把这Num个单元全部分配出去，首地址存入*ppReserved
+	//@ret:成功返回true，否则返回false
+	bool addSeg(size_t Num, T **ppReserved)
+	{
+		lock.Lock();
+		uint32_t n = SegNum.load(std::memory_order_relaxed);
+		if (n >= MAX_POOL_SEGMENTS || AllocNum.load(std::memory_order_relaxed) != n)
+		{
+			lock.Unlock();
+			return false;
+		}
+		try {
+			pSeg[n] = new zMemHeap<T>(Num);
+		}
+		catch (std::bad_alloc &)
+		{
+			lock.Unlock();
+			return false;
+		}
+		//新段还没有公开，其他线程不会从里面分配，可以直接预设占用
+		if (ppReserved)
+			*ppReserved = pSeg[n]->Reserve(Num);
+		SegCap[n] = Num;
+		Capacity += Num;
+		//release模式保证其他线程看到新的段数时，新段已经初始化完成
+		SegNum.store(n + 1, std::memory_order_release);
+		AllocNum.store(n + 1, std::memory_order_release);
+		//已经全部分配的段不用作下次分配的起点
+		if (!ppReserved)
+			AllocSeg.store(n, std::memory_order_relaxed);
+		lock.Unlock();
+		return true;
+	}
+};
+
 //*****************调试检测内存泄漏用*********************
 /*
 #if defined(_DEBUG)||defined(DEBUG)
@@ -114,9 +114,11 @@ void zRWLock::WLock(void)
     //设置写锁定标志，供读锁定线程检测，减少总线锁定碰撞概率
 	WriteFlag = true;
 	int Count = 3;
-    uint32_t temp=0;
+    uint32_t temp;
     do
     {
+        //失败的CAS会把Flag当前值写入temp，所以每次尝试前都要重新置0，否则会在有锁的情况下锁定成功
+        temp = 0;
         //如果Flag值是0，那么设置Flag为WRITELOCKMASK，锁定成功,返回。
         //锁定成功用acquire模式，保证受保护读写操作在锁定后才执行；失败用relaxed模式，对执行顺序不加任何限制
         if(std::atomic_compare_exchange_weak_explicit(&Flag,&temp,WRITELOCKMASK,std::memory_order_acquire,std::memory_order_relaxed))
@@ -139,8 +141,11 @@ void zRWLock::WLock(void)
 
 bool zRWLock::TryWLock(void)
 {
-	//如果Flag为0,那么Flag的最高字节设为1，表示写锁定。无需内存屏障。有程序的逻辑顺序保证执行顺序
-    return std::atomic_compare_exchange_weak_explicit(&Flag,0,WRITELOCKMASK,std::memory_order_relaxed,std::memory_order_relaxed);
+	//如果Flag为0,那么Flag的最高字节设为1，表示写锁定。
+    //CAS的期望值参数是指针，必须用变量传递。用strong版本，避免没有锁的时候虚假失败
+    //锁定成功用acquire模式，保证受保护读写操作在锁定后才执行
+    uint32_t temp = 0;
+    return std::atomic_compare_exchange_strong_explicit(&Flag,&temp,WRITELOCKMASK,std::memory_order_acquire,std::memory_order_relaxed);
 }
 
 void zRWLock::WUnlock(void)
@@ -158,4 +163,59 @@ void zRWLock::WToRLock(void)
     //最高字节清零。不能直接清零。因为有可能读锁定改变了低三个字节的值
     std::atomic_fetch_and_explicit(&Flag,0xffffff,std::memory_order_release);
 }
+
+uint32_t zThreadIndex()
+{
+    static std::atomic_uint32_t Next(0);
+    //每个线程第一次调用时从Next取一个序号
+    static thread_local uint32_t Index = std::atomic_fetch_add_explicit(&Next, 1, std::memory_order_relaxed);
+    return Index;
+}
+
+zEpoch::zEpoch()
+{
+    for (int i = 0; i < EPOCH_SLOTS; ++i)
+    {
+        Slots[i].Count[0].store(0, std::memory_order_relaxed);
+        Slots[i].Count[1].store(0, std::memory_order_relaxed);
+    }
+    Epoch.store(0, std::memory_order_relaxed);
+}
+
+uint32_t zEpoch::Enter(void)
+{
+    uint32_t Slot = zThreadIndex() & (EPOCH_SLOTS - 1);
+    do {
+        uint32_t e = Epoch.load(std::memory_order_acquire) & 0x1;
+        //seq_cst模式，和Synchronize()中的纪元切换配对:要么Synchronize()看到本线程的计数，要么本线程看到新的纪元
+        std::atomic_fetch_add_explicit(&Slots[Slot].Count[e], 1, std::memory_order_seq_cst);
+        if ((Epoch.load(std::memory_order_seq_cst) & 0x1) == e)
+            return (Slot << 1) | e;
+        //纪元刚刚切换，撤销计数，在新纪元重新进入。否则Synchronize()可能漏掉本线程
+        std::atomic_fetch_sub_explicit(&Slots[Slot].Count[e], 1, std::memory_order_relaxed);
+    } while (true);
+}
+
+void zEpoch::Synchronize(void)
+{
+    lock.Lock();
+    //切换纪元。之后进入的读线程计入新纪元的计数，只需要等待旧纪元的计数全部归零
+    uint32_t e = std::atomic_fetch_add_explicit(&Epoch, 1, std::memory_order_seq_cst) & 0x1;
+    for (int i = 0; i < EPOCH_SLOTS; ++i)
+    {
+        int Count = 3;
+        while (Slots[i].Count[e].load(std::memory_order_acquire))
+        {
+            if (!Count)
+            {
+                std::this_thread::yield();
+                Count = 3;
+            }
+            else
+                for (int k = 0; k < 37; ++k) { zNop8(); }
+            --Count;
+        }
+    }
+    lock.Unlock();
+}
 }//NAME SPACE ZZG
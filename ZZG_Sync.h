@@ -121,6 +121,45 @@ public:
         std::atomic_fetch_sub_explicit(&Version,1,std::memory_order_release);
 		lock.Unlock();
 	}
+	//尝试写锁定。锁定成功返回true。若其它线程已经锁定，立即返回false
+	bool TryWLock()
+	{
+        if (!lock.TryLock())
+            return false;
+        std::atomic_fetch_add_explicit(&Version,1,std::memory_order_acquire);
+        return true;
+	}
+
+	//只锁定写线程，不改变版本号。锁定期间其他线程不能写锁定，数据保持不变，但是读数据不受影响，不用重读。
+	//用于在原地较长时间地读取数据，不必把数据复制出来
+	void LockWriters()
+	{
+        lock.Lock();
+	}
+	//尝试只锁定写线程。锁定成功返回true。若其它线程已经锁定，立即返回false
+	bool TryLockWriters()
+	{
+        if (!lock.TryLock())
+            return false;
+        //TryLock()没有内存屏障，acquire保证之后读取的数据是其它写线程解锁之前修改完成的
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+	}
+	//在LockWriters()锁定期间修改数据。版本号变成奇数，读线程需要重读。修改完成后调用WriteEnd()
+	void WriteBegin()
+	{
+        std::atomic_fetch_add_explicit(&Version,1,std::memory_order_acquire);
+	}
+	//修改完成，版本号恢复为偶数。写线程仍然保持锁定，直到UnlockWriters()
+	void WriteEnd()
+	{
+        std::atomic_fetch_add_explicit(&Version,1,std::memory_order_release);
+	}
+	//解锁LockWriters()
+	void UnlockWriters()
+	{
+        lock.Unlock();
+	}
 };
 
 
@@ -160,5 +199,41 @@ public:
 	void WToRLock(void);
 };
 
+
+//线程序号。线程第一次调用时分配，从0开始依次递增，以后每次调用都返回同一个值
+//主要用来把不同的线程分散到不同的计数槽上，减少多个线程修改同一个缓存行造成的争用
+uint32_t zThreadIndex();
+
+
+/*****纪元(Epoch)内存回收******
+用于无锁读取的内存延迟回收。读线程在访问共享数据之前调用Enter()，访问完调用Leave()，期间不加任何锁。
+写线程把数据节点从数据结构中摘除之后，不能马上释放，必须先调用Synchronize()，等待摘除之前已经进入的读线程全部离开，才可以释放。
+摘除之后才进入的读线程已经看不到被摘除的节点了，所以不用等待。
+读线程计数分散在EPOCH_SLOTS个独占缓存行的计数槽上，每个线程按zThreadIndex()选择自己的槽，读线程之间基本没有缓存行争用。
+Synchronize()开销较大，应该攒够一批待释放的节点后再调用。读线程在Enter()和Leave()之间不能调用Synchronize()，否则会等待自己
+*******/
+#define EPOCH_SLOTS	64	//计数槽个数，必须是2的整数次幂
+class zEpoch {
+    //计数槽。Count[0]和Count[1]分别记录在偶数纪元和奇数纪元进入的读线程数量
+    struct alignas(64) SLOT {
+        std::atomic_uint32_t Count[2];
+    };
+    SLOT Slots[EPOCH_SLOTS];
+    std::atomic_uint32_t Epoch;	//当前纪元
+    zLock lock;	//保证同时只有一个线程执行Synchronize()
+public:
+    zEpoch();
+    //进入读临界区。返回值必须原样传给Leave()
+    uint32_t Enter(void);
+    //离开读临界区
+    void Leave(uint32_t Token)
+    {
+        //release模式，保证临界区内的读操作在离开之前完成
+        std::atomic_fetch_sub_explicit(&Slots[Token >> 1].Count[Token & 0x1], 1, std::memory_order_release);
+    }
+    //等待调用之前进入的读线程全部离开
+    void Synchronize(void);
+};
+
 }
 #endif//!ZZG_SYNC_H_2310
@@ -0,0 +1,428 @@
+//benchmark.cpp by Phelps Zhao
+//Version 20231001
+/********* Instructions for use *****************
+* A standalone benchmark which needs nothing but standard C++17. Build it with the library sources, e.g.
+* g++ -std=c++17 -O2 -pthread benchmark.cpp ZZG_Mem.cpp ZZG_Sync.cpp -o benchmark
+* cl /std:c++17 /O2 /EHsc benchmark.cpp ZZG_Mem.cpp ZZG_Sync.cpp
+* Usage: benchmark [MaxThreads] [Milliseconds]
+* MaxThreads:the largest number of threads.The tests run with 1,2,4... threads up to it. The default is the number of hardware threads
+* Milliseconds:the running time of each test. The default is 1000
+*
+* It measures:
+* 1, zHash and zShardedHash against std::unordered_map with std::shared_mutex,for 64-bit integer keys,short strings(8 characters) and long strings(40 characters),
+* with three operation mixes(read/insert/delete percentages 90/5/5,50/25/25 and 10/45/45)
+* 2, zMemHeap against new/delete for fixed-size allocation
+* 3, zLock,zRWLock and zSeqLock against std::mutex and std::shared_mutex
+* 4, zHash with each thread working on its own bucket next to the buckets of the other threads,which shows the false sharing between
+* neighbouring bucket entries. Build it again with -DZZG_PAD_BUCKETS to compare the padded layout with the packed one
+* Each line reports the throughput(operations per second of all threads) and the p50/p99/p999 latencies of single operations.
+* One operation in LATENCY_SAMPLE is timed,so timing doesn't slow down the test much
+*********************************************/
+#include "ZZG_Hash.h"
+#include "ZZG_Mem.h"
+#include "ZZG_Sync.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define KEY_SPACE	(1 << 20)	//The number of distinct keys.Half of them are inserted before each test
+#define LATENCY_SAMPLE	16	//One operation in LATENCY_SAMPLE is timed
+#define TIME_CHECK	256	//The running time is checked once per TIME_CHECK operations
+
+typedef std::chrono::steady_clock CLOCK;
+
+//A fast random number generator for each thread(xorshift64*)
+struct RANDOM {
+    uint64_t s;
+    RANDOM(uint64_t Seed) : s(Seed * 0x9E3779B97F4A7C15ull + 1) {}
+    uint64_t Next()
+    {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545F4914F6CDD1Dull;
+    }
+};
+
+//The result of a test
+struct RESULT {
+    double OpsPerSec;
+    int64_t P50, P99, P999;	//Latencies in nanoseconds
+};
+
+//Runs Fun(ThreadIndex,Random) repeatedly in (Threads) threads for (Ms) milliseconds.
+//Fun performs exactly one operation per call,and one call in LATENCY_SAMPLE is timed
+template <class F>
+RESULT runThreads(int Threads, int Ms, F Fun)
+{
+    std::atomic<int> Ready(0);
+    std::atomic<bool> Go(false);
+    std::vector<uint64_t> Ops(Threads);
+    std::vector<std::vector<int64_t>> Lat(Threads);
+    std::vector<std::thread> Workers;
+    for (int t = 0; t < Threads; ++t)
+    {
+        Workers.emplace_back([&, t]() {
+            RANDOM Rand(t + 1);
+            std::vector<int64_t> &L = Lat[t];
+            L.reserve(1 << 20);
+            uint64_t n = 0;
+            ++Ready;
+            while (!Go.load(std::memory_order_acquire))
+                ;
+            CLOCK::time_point End = CLOCK::now() + std::chrono::milliseconds(Ms);
+            do {
+                for (int i = 0; i < TIME_CHECK; ++i, ++n)
+                {
+                    if (n % LATENCY_SAMPLE == 0)
+                    {
+                        CLOCK::time_point t0 = CLOCK::now();
+                        Fun(t, Rand);
+                        L.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(CLOCK::now() - t0).count());
+                    }
+                    else
+                        Fun(t, Rand);
+                }
+            } while (CLOCK::now() < End);
+            Ops[t] = n;
+        });
+    }
+    while (Ready.load() < Threads)
+        std::this_thread::yield();
+    CLOCK::time_point t0 = CLOCK::now();
+    Go.store(true, std::memory_order_release);
+    for (std::thread &w : Workers)
+        w.join();
+    double Secs = std::chrono::duration<double>(CLOCK::now() - t0).count();
+
+    RESULT r;
+    uint64_t Total = 0;
+    std::vector<int64_t> All;
+    for (int t = 0; t < Threads; ++t)
+    {
+        Total += Ops[t];
+        All.insert(All.end(), Lat[t].begin(), Lat[t].end());
+    }
+    std::sort(All.begin(), All.end());
+    r.OpsPerSec = Total / Secs;
+    r.P50 = All.empty() ? 0 : All[All.size() / 2];
+    r.P99 = All.empty() ? 0 : All[All.size() * 99 / 100];
+    r.P999 = All.empty() ? 0 : All[All.size() * 999 / 1000];
+    return r;
+}
+
+void printResult(const char *Name, const char *Type, const char *Mix, int Threads, const RESULT &r)
+{
+    printf("%-22s %-8s %-9s T=%-3d %12.0f ops/s  p50=%6lldns p99=%7lldns p999=%8lldns\n", Name, Type, Mix, Threads,
+           r.OpsPerSec, (long long)r.P50, (long long)r.P99, (long long)r.P999);
+    fflush(stdout);
+}
+
+//*****************Hash tables*****************
+
+//zHash with the interface used by the benchmark
+template <class TK>
+struct ZHASH_MAP {
+    ZZG::zHash<TK, uint64_t> Hash;
+    bool Value(const TK &Key, uint64_t *pValue) { return Hash.Value(Key, pValue); }
+    void Insert(const TK &Key, uint64_t Value) { Hash.Insert(Key, Value); }
+    void Del(const TK &Key) { Hash.Del(Key); }
+};
+
+//zShardedHash with the interface used by the benchmark
+template <class TK>
+struct ZSHARDED_MAP {
+    ZZG::zShardedHash<TK, uint64_t> Hash;
+    bool Value(const TK &Key, uint64_t *pValue) { return Hash.Value(Key, pValue); }
+    void Insert(const TK &Key, uint64_t Value) { Hash.Insert(Key, Value); }
+    void Del(const TK &Key) { Hash.Del(Key); }
+};
+
+//std::unordered_map protected by std::shared_mutex
+template <class TK>
+struct STD_MAP {
+    std::unordered_map<TK, uint64_t> Map;
+    std::shared_mutex Lock;
+    bool Value(const TK &Key, uint64_t *pValue)
+    {
+        std::shared_lock<std::shared_mutex> l(Lock);
+        auto it = Map.find(Key);
+        if (it == Map.end())
+            return false;
+        *pValue = it->second;
+        return true;
+    }
+    void Insert(const TK &Key, uint64_t Value)
+    {
+        std::unique_lock<std::shared_mutex> l(Lock);
+        Map.emplace(Key, Value);
+    }
+    void Del(const TK &Key)
+    {
+        std::unique_lock<std::shared_mutex> l(Lock);
+        Map.erase(Key);
+    }
+};
+
+//Creates KEY_SPACE distinct keys
+void makeKeys(std::vector<uint64_t> &Keys)
+{
+    Keys.resize(KEY_SPACE);
+    RANDOM Rand(12345);
+    for (uint64_t &k : Keys)
+        k = Rand.Next();
+}
+
+void makeKeys(std::vector<std::string> &Keys, size_t Len)
+{
+    //The index is written into the string,so the keys are distinct
+    Keys.resize(KEY_SPACE);
+    RANDOM Rand(12345);
+    for (size_t i = 0; i < Keys.size(); ++i)
+    {
+        std::string &s = Keys[i];
+        s.resize(Len);
+        for (size_t k = 0; k < Len; ++k)
+            s[k] = (char)('a' + Rand.Next() % 26);
+        for (size_t n = i, k = 0; k < 5 && k < Len; ++k, n /= 26)
+            s[k] = (char)('a' + n % 26);
+    }
+}
+
+//Runs one operation mix on a new map
+template <class MAP, class TK>
+void benchMap(const char *Name, const char *Type, const std::vector<TK> &Keys, int ReadPct, int InsertPct, int Threads, int Ms)
+{
+    MAP *pMap = new MAP;
+    for (size_t i = 0; i < Keys.size(); i += 2)
+        pMap->Insert(Keys[i], i);
+    RESULT r = runThreads(Threads, Ms, [&](int, RANDOM &Rand) {
+        uint64_t x = Rand.Next();
+        const TK &Key = Keys[x % KEY_SPACE];
+        int Op = (int)((x >> 32) % 100);
+        uint64_t Value;
+        if (Op < ReadPct)
+            pMap->Value(Key, &Value);
+        else if (Op < ReadPct + InsertPct)
+            pMap->Insert(Key, x);
+        else
+            pMap->Del(Key);
+    });
+    char Mix[16];
+    snprintf(Mix, sizeof(Mix), "%d/%d/%d", ReadPct, InsertPct, 100 - ReadPct - InsertPct);
+    printResult(Name, Type, Mix, Threads, r);
+    delete pMap;
+}
+
+template <class TK>
+void benchHashes(const char *Type, const std::vector<TK> &Keys, const std::vector<int> &ThreadNums, int Ms)
+{
+    static const int Mixes[][2] = {{90, 5}, {50, 25}, {10, 45}};
+    for (const int *Mix : Mixes)
+    {
+        for (int t : ThreadNums)
+        {
+            benchMap<ZHASH_MAP<TK>>("zHash", Type, Keys, Mix[0], Mix[1], t, Ms);
+            benchMap<ZSHARDED_MAP<TK>>("zShardedHash", Type, Keys, Mix[0], Mix[1], t, Ms);
+            benchMap<STD_MAP<TK>>("unordered_map+shared", Type, Keys, Mix[0], Mix[1], t, Ms);
+        }
+    }
+}
+
+//*****************Memory heap*****************
+
+#define HEAP_HOLD	64	//The number of blocks each thread holds.A block is freed and another is allocated in each operation
+
+struct BLOCK {
+    uint64_t Data[8];
+};
+
+void benchHeaps(const std::vector<int> &ThreadNums, int Ms)
+{
+    for (int t : ThreadNums)
+    {
+        ZZG::zMemHeap<BLOCK> *pHeap = new ZZG::zMemHeap<BLOCK>(t * HEAP_HOLD * 2);
+        std::vector<BLOCK*> Held(t * HEAP_HOLD, nullptr);
+        RESULT r = runThreads(t, Ms, [&](int Thread, RANDOM &Rand) {
+            BLOCK *&p = Held[Thread * HEAP_HOLD + Rand.Next() % HEAP_HOLD];
+            if (p)
+                pHeap->LockFree(p);
+            p = pHeap->LockAlloc();
+        });
+        printResult("zMemHeap", "64B", "free+alloc", t, r);
+        for (BLOCK *p : Held)
+            if (p)
+                pHeap->LockFree(p);
+        delete pHeap;
+
+        std::fill(Held.begin(), Held.end(), nullptr);
+        r = runThreads(t, Ms, [&](int Thread, RANDOM &Rand) {
+            BLOCK *&p = Held[Thread * HEAP_HOLD + Rand.Next() % HEAP_HOLD];
+            delete p;
+            p = new BLOCK;
+        });
+        printResult("new/delete", "64B", "free+alloc", t, r);
+        for (BLOCK *p : Held)
+            delete p;
+    }
+}
+
+//*****************Locks*****************
+
+//The shared data protected by the locks.Each operation reads or writes it
+struct SHARED {
+    uint64_t a, b;
+};
+
+void benchLocks(const std::vector<int> &ThreadNums, int Ms)
+{
+    for (int t : ThreadNums)
+    {
+        SHARED Data = {0, 0};
+        ZZG::zLock Lock;
+        RESULT r = runThreads(t, Ms, [&](int, RANDOM &) {
+            Lock.Lock();
+            ++Data.a;
+            Lock.Unlock();
+        });
+        printResult("zLock", "-", "write", t, r);
+
+        std::mutex Mutex;
+        r = runThreads(t, Ms, [&](int, RANDOM &) {
+            std::lock_guard<std::mutex> l(Mutex);
+            ++Data.a;
+        });
+        printResult("std::mutex", "-", "write", t, r);
+
+        //Reads with one write in 16 operations
+        ZZG::zRWLock RWLock;
+        r = runThreads(t, Ms, [&](int, RANDOM &Rand) {
+            if (Rand.Next() % 16)
+            {
+                RWLock.RLock();
+                volatile uint64_t x = Data.a + Data.b;
+                (void)x;
+                RWLock.RUnlock();
+            }
+            else
+            {
+                RWLock.WLock();
+                ++Data.a;
+                ++Data.b;
+                RWLock.WUnlock();
+            }
+        });
+        printResult("zRWLock", "-", "15r/1w", t, r);
+
+        ZZG::zSeqLock SeqLock;
+        r = runThreads(t, Ms, [&](int, RANDOM &Rand) {
+            if (Rand.Next() % 16)
+            {
+                int Ver;
+                uint64_t x;
+                do {
+                    Ver = SeqLock.ReadBegin();
+                    x = Data.a + Data.b;
+                } while (SeqLock.ReadRetry(Ver));
+                volatile uint64_t y = x;
+                (void)y;
+            }
+            else
+            {
+                SeqLock.WLock();
+                ++Data.a;
+                ++Data.b;
+                SeqLock.WUnlock();
+            }
+        });
+        printResult("zSeqLock", "-", "15r/1w", t, r);
+
+        std::shared_mutex SharedMutex;
+        r = runThreads(t, Ms, [&](int, RANDOM &Rand) {
+            if (Rand.Next() % 16)
+            {
+                std::shared_lock<std::shared_mutex> l(SharedMutex);
+                volatile uint64_t x = Data.a + Data.b;
+                (void)x;
+            }
+            else
+            {
+                std::unique_lock<std::shared_mutex> l(SharedMutex);
+                ++Data.a;
+                ++Data.b;
+            }
+        });
+        printResult("std::shared_mutex", "-", "15r/1w", t, r);
+    }
+}
+
+//*****************Bucket layout*****************
+
+//Thread t inserts,deletes and looks up only the key t.The hash function keeps the keys in adjacent buckets,so the threads share the
+//cache lines of the bucket table unless the buckets are padded
+void benchBuckets(const std::vector<int> &ThreadNums, int Ms)
+{
+#if defined(ZZG_PAD_BUCKETS)
+    const char *Layout = "padded";
+#else
+    const char *Layout = "packed";
+#endif
+    for (int t : ThreadNums)
+    {
+        ZZG::zHash<uint64_t, uint64_t> Hash;
+        Hash.SetHashFunction([](const uint64_t &Key) { return (size_t)Key; });
+        RESULT r = runThreads(t, Ms, [&](int Thread, RANDOM &Rand) {
+            uint64_t Key = Thread, Value;
+            uint64_t Op = Rand.Next() % 16;
+            if (Op == 0)
+                Hash.Insert(Key, Key);
+            else if (Op == 1)
+                Hash.Del(Key);
+            else
+                Hash.Value(Key, &Value);
+        });
+        printResult("zHash", Layout, "neighbour", t, r);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int MaxThreads = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+    int Ms = argc > 2 ? atoi(argv[2]) : 1000;
+    if (MaxThreads < 1)
+        MaxThreads = 1;
+    if (Ms < 1)
+        Ms = 1000;
+    std::vector<int> ThreadNums;
+    for (int t = 1; t < MaxThreads; t <<= 1)
+        ThreadNums.push_back(t);
+    ThreadNums.push_back(MaxThreads);
+    printf("Threads:1..%d,%dms per test,%d keys,mix=read/insert/delete percentages\n", MaxThreads, Ms, KEY_SPACE);
+
+    std::vector<uint64_t> IntKeys;
+    makeKeys(IntKeys);
+    benchHashes("uint64", IntKeys, ThreadNums, Ms);
+    IntKeys.clear();
+    IntKeys.shrink_to_fit();
+
+    std::vector<std::string> StrKeys;
+    makeKeys(StrKeys, 8);
+    benchHashes("str8", StrKeys, ThreadNums, Ms);
+    makeKeys(StrKeys, 40);
+    benchHashes("str40", StrKeys, ThreadNums, Ms);
+    StrKeys.clear();
+    StrKeys.shrink_to_fit();
+
+    benchHeaps(ThreadNums, Ms);
+    benchLocks(ThreadNums, Ms);
+    benchBuckets(ThreadNums, Ms);
+    return 0;
+}
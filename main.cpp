@@ -7,6 +7,9 @@
 #include <QRandomGenerator64>
 #include <string>
 #include <QTime>
+#include <chrono>
+#include <thread>
+#include <atomic>
 
 //Multiplies by 3/4,just considering the load factor of 0.75
 #define LOOPS   1024*1024*3/4
@@ -65,5 +68,55 @@ int main(int argc, char *argv[])
         .arg(Buckets).arg(FilledBuckets).arg(Elements).arg(Collitions).arg(MaxCollition);
     std::cout << str.toUtf8().constData();
 
+    //-------Worst single-operation latency while the table grows------------------
+    //The hash table grows from 256 buckets to millions of buckets. Each insertion and each lookup is timed
+    ZZG::zHash <uint64_t, uint64_t> GrowHash;
+    std::atomic<bool> Stop(false);
+    int64_t MaxInsertNs = 0, MaxValueNs = 0;
+    std::thread Reader([&]() {
+        uint64_t v, k = 0;
+        while (!Stop.load(std::memory_order_relaxed))
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            GrowHash.Value(k, &v);
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+            if (ns > MaxValueNs)
+                MaxValueNs = ns;
+            k = (k + 7919) % (LOOPS * 4);
+        }
+    });
+    T0 = QTime::currentTime();
+    for (i = 0; i < LOOPS * 4; ++i)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        GrowHash.Insert(pRandNum[i % (LOOPS * 3)] % (LOOPS * 4), i);
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        if (ns > MaxInsertNs)
+            MaxInsertNs = ns;
+    }
+    T1 = QTime::currentTime();
+    Stop = true;
+    Reader.join();
+    str = QString(u8"Growing to %1 buckets:time:%2ms;worst Insert:%3us;worst Value:%4us\n").arg(GrowHash.GetBucketNum())
+        .arg(T0.msecsTo(T1)).arg(MaxInsertNs / 1000).arg(MaxValueNs / 1000);
+    std::cout << str.toUtf8().constData();
+
+    //-------zFlatHash against zHash with 64-bit integer keys------------------
+    ZZG::zFlatHash <uint64_t, uint64_t> FlatHash;
+    ZZG::zHash <uint64_t, uint64_t> NodeHash;
+    T0 = QTime::currentTime();
+    for (i = 0; i < LOOPS; ++i)
+        FlatHash.Insert(pRandNum[i], i);
+    for (i = 0; i < LOOPS; ++i)
+        FlatHash.Value(pRandNum[i], &Value);
+    T1 = QTime::currentTime();
+    for (i = 0; i < LOOPS; ++i)
+        NodeHash.Insert(pRandNum[i], i);
+    for (i = 0; i < LOOPS; ++i)
+        NodeHash.Value(pRandNum[i], &Value);
+    T2 = QTime::currentTime();
+    str = QString(u8"zFlatHash time:%1;zHash time:%2\n").arg(T0.msecsTo(T1)).arg(T1.msecsTo(T2));
+    std::cout << str.toUtf8().constData();
+
   //  return a.exec();
 }